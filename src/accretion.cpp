@@ -0,0 +1,62 @@
+#include "gravity.h"
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
+using namespace std;
+
+namespace gravity{
+
+static unsigned FindRoot(ArenaVector<unsigned>& parent, unsigned i){
+    while(parent[i] != i){
+        parent[i] = parent[parent[i]];  // path halving
+        i = parent[i];
+    }
+    return i;
+}
+
+void MergeBodies(World& world, const vector<pair<unsigned, unsigned>>& pairs){
+    size_t n = world.size();
+    const Boundary& boundary = world.config.boundary;
+
+    // group every chain of touching bodies, rooted at its lowest index
+    Arena& arena = world.arenas().local(0);
+    ArenaVector<unsigned> parent = MakeArenaVector<unsigned>(arena, n);
+    iota(parent.begin(), parent.end(), 0u);
+    for(const pair<unsigned, unsigned>& p : pairs){
+        unsigned a = FindRoot(parent, p.first), b = FindRoot(parent, p.second);
+        if(a != b){
+            parent[max(a, b)] = min(a, b);
+        }
+    }
+
+    // fold each body into its root in index order, so the result does not depend on pair order
+    ArenaVector<uint8_t> keep = MakeArenaVector<uint8_t>(arena, n);
+    fill(keep.begin(), keep.end(), 1);
+    for(unsigned i = 0; i < n; i++){
+        unsigned root = FindRoot(parent, i);
+        if(root == i){
+            continue;
+        }
+        keep[i] = 0;
+        float m1 = world.mass[root], m2 = world.mass[i];
+        float total = m1 + m2;
+        float dx = world.x[i] - world.x[root];
+        float dy = world.y[i] - world.y[root];
+        boundary.minimumImage(dx, dy);
+        world.x[root] += dx * m2 / total;   // center of mass
+        world.y[root] += dy * m2 / total;
+        world.vx[root] = (m1 * world.vx[root] + m2 * world.vx[i]) / total;  // momentum
+        world.vy[root] = (m1 * world.vy[root] + m2 * world.vy[i]) / total;
+        world.ax[root] = (m1 * world.ax[root] + m2 * world.ax[i]) / total;
+        world.ay[root] = (m1 * world.ay[root] + m2 * world.ay[i]) / total;
+        world.radius[root] = sqrt(world.radius[root] * world.radius[root] + world.radius[i] * world.radius[i]);    // area
+        world.red[root] = (m1 * world.red[root] + m2 * world.red[i]) / total;
+        world.green[root] = (m1 * world.green[root] + m2 * world.green[i]) / total;
+        world.blue[root] = (m1 * world.blue[root] + m2 * world.blue[i]) / total;
+        world.mass[root] = total;
+    }
+    world.compact(keep.data());    // before the next force pass, so merged-away bodies never cost anything
+}
+
+}
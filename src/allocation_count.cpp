@@ -0,0 +1,41 @@
+#include "allocation_count.h"
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+using namespace std;
+
+namespace gravity{
+
+static atomic<bool> counting{false};
+static atomic<uint64_t> allocations{0};
+
+void EnableAllocationCounting(bool on){
+    counting.store(on, memory_order_relaxed);
+}
+
+uint64_t GlobalAllocations(){
+    return allocations.load(memory_order_relaxed);
+}
+
+}
+
+// Replacing these is enough: the array and nothrow forms forward to them.
+void* operator new(size_t bytes){
+    if(gravity::counting.load(memory_order_relaxed)){
+        gravity::allocations.fetch_add(1, memory_order_relaxed);
+    }
+    void* memory = malloc(bytes ? bytes : 1);
+    if(!memory){
+        throw bad_alloc();
+    }
+    return memory;
+}
+
+void operator delete(void* memory) noexcept{
+    free(memory);
+}
+
+void operator delete(void* memory, size_t) noexcept{
+    free(memory);
+}
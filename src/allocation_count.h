@@ -0,0 +1,12 @@
+#pragma once
+#include <cstdint>
+
+namespace gravity{
+
+// Counts calls to the global operator new, to check that steady state steps stay off
+// the heap. Counting is off until enabled; while off it costs one relaxed load per
+// allocation.
+void EnableAllocationCounting(bool on = true);
+uint64_t GlobalAllocations();   // since counting was first enabled
+
+}
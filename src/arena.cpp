@@ -0,0 +1,57 @@
+#include "arena.h"
+#include <algorithm>
+
+using namespace std;
+
+namespace gravity{
+
+void Arena::addBlock(size_t bytes){
+    blocks.push_back({unique_ptr<char[]>(new char[bytes]), bytes});
+    offset = 0;
+    heapBlocks++;
+}
+
+void* Arena::allocate(size_t bytes, size_t alignment){
+    if(!blocks.empty()){
+        Block& block = blocks.back();
+        uintptr_t start = uintptr_t(block.memory.get()) + offset;
+        size_t padding = (alignment - start % alignment) % alignment;
+        if(offset + padding + bytes <= block.size){
+            offset += padding + bytes;
+            return block.memory.get() + offset - bytes;
+        }
+    }
+    addBlock(max(max(FIRST_BLOCK, capacity()), bytes + alignment));   // at least doubles the arena
+    return allocate(bytes, alignment);
+}
+
+void Arena::reset(){
+    if(blocks.size() > 1){
+        size_t total = capacity();
+        blocks.clear();
+        addBlock(total);
+    }
+    offset = 0;
+}
+
+size_t Arena::capacity() const{
+    size_t total = 0;
+    for(const Block& block : blocks){
+        total += block.size;
+    }
+    return total;
+}
+
+void StepArenas::resize(unsigned threads){
+    while(arenas.size() < threads){
+        arenas.emplace_back(new Arena());
+    }
+}
+
+void StepArenas::reset(){
+    for(unique_ptr<Arena>& arena : arenas){
+        arena->reset();
+    }
+}
+
+}
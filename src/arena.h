@@ -0,0 +1,80 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace gravity{
+
+// Monotonic allocator for data that only lives for one step. Allocation moves a pointer
+// forward and freeing does nothing; reset() gives everything back at once. A step that
+// outgrows the arena gets an extra block from the heap, and the next reset merges the
+// blocks into one of the combined size, so after a few steps the arena never touches
+// the global heap again.
+class Arena{
+public:
+    Arena() = default;
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    void* allocate(size_t bytes, size_t alignment);
+    template<class T> T* allocateArray(size_t count){
+        return static_cast<T*>(allocate(count * sizeof(T), alignof(T)));
+    }
+    void reset();
+
+    size_t capacity() const;    // bytes in all blocks
+    size_t blockAllocations() const{ return heapBlocks; }   // heap allocations made so far
+
+private:
+    static constexpr size_t FIRST_BLOCK = 64 * 1024;
+
+    struct Block{
+        std::unique_ptr<char[]> memory;
+        size_t size;
+    };
+    void addBlock(size_t bytes);
+
+    std::vector<Block> blocks;
+    size_t offset = 0;      // into blocks.back()
+    size_t heapBlocks = 0;
+};
+
+// Standard allocator on top of an Arena, so transient containers can be used as usual.
+template<class T> class ArenaAllocator{
+public:
+    using value_type = T;
+
+    explicit ArenaAllocator(Arena& arena) : arena(&arena){}
+    template<class U> ArenaAllocator(const ArenaAllocator<U>& other) : arena(other.arena){}
+
+    T* allocate(size_t count){ return arena->allocateArray<T>(count); }
+    void deallocate(T*, size_t){}
+
+    template<class U> bool operator==(const ArenaAllocator<U>& other) const{ return arena == other.arena; }
+    template<class U> bool operator!=(const ArenaAllocator<U>& other) const{ return arena != other.arena; }
+
+    Arena* arena;
+};
+
+template<class T> using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+
+// count value-initialized elements in arena
+template<class T> ArenaVector<T> MakeArenaVector(Arena& arena, size_t count = 0){
+    return ArenaVector<T>(count, T(), ArenaAllocator<T>(arena));
+}
+
+// One arena per pool thread, so parallel passes allocate without sharing a lock or a
+// cache line. Index them with the thread number ThreadPool::run hands to each slice.
+class StepArenas{
+public:
+    void resize(unsigned threads);
+    unsigned size() const{ return unsigned(arenas.size()); }
+    Arena& local(unsigned thread){ return *arenas[thread]; }
+    void reset();
+
+private:
+    std::vector<std::unique_ptr<Arena>> arenas;
+};
+
+}
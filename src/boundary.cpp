@@ -0,0 +1,49 @@
+#include "boundary.h"
+#include "gravity.h"
+#include <cmath>
+
+using namespace std;
+
+namespace gravity{
+
+static void Reflect(vector<float>& position, vector<float>& velocity, const vector<float>& radius, float low, float high, float restitution){
+    size_t n = position.size();
+    for(size_t i = 0; i < n; i++){  // each axis on its own, so corner hits bounce off both walls
+        if(position[i] - radius[i] <= low){
+            position[i] = low + radius[i];
+            if(velocity[i] < 0.0f){     // only a body still heading into the wall bounces and loses speed
+                velocity[i] = -velocity[i] * restitution;
+            }
+        }
+        else if(position[i] + radius[i] >= high){
+            position[i] = high - radius[i];
+            if(velocity[i] > 0.0f){
+                velocity[i] = -velocity[i] * restitution;
+            }
+        }
+    }
+}
+
+static void Wrap(vector<float>& position, float low, float size){
+    for(float& p : position){
+        p -= size * floor((p - low) / size);
+    }
+}
+
+void ApplyBoundary(World& world){
+    const Boundary& boundary = world.config.boundary;
+    switch(boundary.kind){
+    case BoundaryKind::Open:
+        break;
+    case BoundaryKind::Reflective:
+        Reflect(world.x, world.vx, world.radius, boundary.minX, boundary.maxX, boundary.restitution);
+        Reflect(world.y, world.vy, world.radius, boundary.minY, boundary.maxY, boundary.restitution);
+        break;
+    case BoundaryKind::Periodic:
+        Wrap(world.x, boundary.minX, boundary.width());
+        Wrap(world.y, boundary.minY, boundary.height());
+        break;
+    }
+}
+
+}
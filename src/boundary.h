@@ -0,0 +1,36 @@
+#pragma once
+#include <cmath>
+
+namespace gravity{
+
+class World;
+
+enum class BoundaryKind{
+    Open,       // no walls, bodies fly off forever
+    Reflective, // bodies bounce off the box edges
+    Periodic,   // bodies leaving one edge come back in on the opposite one
+};
+
+struct Boundary{
+    BoundaryKind kind = BoundaryKind::Reflective;
+    float minX = -1.0f, minY = -1.0f;   // the box, by default the [-1, 1] window
+    float maxX = 1.0f, maxY = 1.0f;
+    float restitution = 0.95f;          // bounce off a reflective wall
+
+    float width() const{ return maxX - minX; }
+    float height() const{ return maxY - minY; }
+
+    // Shortens a displacement to the nearest periodic image of the other body.
+    void minimumImage(float& dx, float& dy) const{
+        if(kind != BoundaryKind::Periodic){
+            return;
+        }
+        dx -= width() * std::round(dx / width());
+        dy -= height() * std::round(dy / height());
+    }
+};
+
+// Boundary pass, run after collisions. Does nothing for an open boundary.
+void ApplyBoundary(World& world);
+
+}
@@ -0,0 +1,109 @@
+#include "gravity.h"
+#include "profiler.h"
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
+using namespace std;
+
+namespace gravity{
+
+struct Impact{
+    float time;
+    unsigned a, b;
+};
+
+// Earliest time in [0, dt] at which two moving circles touch, or a negative number if
+// they do not. Pairs already overlapping at the start are left to the narrow phase.
+static float TimeOfImpact(float dx, float dy, float dvx, float dvy, float reach, float dt){
+    float c = dx * dx + dy * dy - reach * reach;
+    if(c <= 0.0f){
+        return -1.0f;
+    }
+    float b = dx * dvx + dy * dvy;
+    if(b >= 0.0f){  // moving apart
+        return -1.0f;
+    }
+    float a = dvx * dvx + dvy * dvy;
+    float discriminant = b * b - a * c;
+    if(discriminant < 0.0f){
+        return -1.0f;
+    }
+    float t = (-b - sqrt(discriminant)) / a;
+    return t <= dt ? t : -1.0f;
+}
+
+void SweptCollisions(World& world, float dt, vector<uint8_t>& moved){
+    size_t n = world.size();
+    const Boundary& boundary = world.config.boundary;
+    moved.assign(n, 0);
+
+    // sweep over the x extent of every body's path this step
+    Arena& arena = world.arenas().local(0);
+    ArenaVector<float> low = MakeArenaVector<float>(arena, n);
+    ArenaVector<float> high = MakeArenaVector<float>(arena, n);
+    ArenaVector<unsigned> order = MakeArenaVector<unsigned>(arena, n);
+    for(size_t i = 0; i < n; i++){
+        float end = world.x[i] + world.vx[i] * dt;
+        low[i] = min(world.x[i], end) - world.radius[i];
+        high[i] = max(world.x[i], end) + world.radius[i];
+    }
+    iota(order.begin(), order.end(), 0u);
+    sort(order.begin(), order.end(), [&](unsigned a, unsigned b){ return low[a] < low[b]; });
+
+    ArenaVector<Impact> impacts = MakeArenaVector<Impact>(arena);
+    {
+        ScopedTimer timer(Phase::NarrowPhase);
+        for(size_t k = 0; k < n; k++){
+            unsigned i = order[k];
+            // a periodic box can wrap a path around, so fall back to testing everything there
+            bool wraps = boundary.kind == BoundaryKind::Periodic;
+            for(size_t m = k + 1; m < n && (wraps || low[order[m]] <= high[i]); m++){
+                unsigned j = order[m];
+                float dx = world.x[j] - world.x[i];
+                float dy = world.y[j] - world.y[i];
+                boundary.minimumImage(dx, dy);
+                float t = TimeOfImpact(dx, dy, world.vx[j] - world.vx[i], world.vy[j] - world.vy[i],
+                    world.radius[i] + world.radius[j], dt);
+                if(t >= 0.0f){
+                    impacts.push_back({t, min(i, j), max(i, j)});
+                }
+            }
+        }
+        // earliest first, ties by index so the outcome does not depend on sort stability
+        sort(impacts.begin(), impacts.end(), [](const Impact& p, const Impact& q){
+            return p.time != q.time ? p.time < q.time : (p.a != q.a ? p.a < q.a : p.b < q.b);
+        });
+    }
+
+    // sub-step only the bodies that hit something: move to the impact, resolve, then finish the step
+    bool merge = world.config.response == CollisionResponse::Merge;
+    vector<pair<unsigned, unsigned>>& merges = world.workspace.merges;
+    merges.clear();
+    for(const Impact& impact : impacts){
+        if(moved[impact.a] || moved[impact.b]){
+            continue;   // a body bounces once per step here, later contacts go to the narrow phase
+        }
+        moved[impact.a] = moved[impact.b] = 1;
+        if(merge){
+            merges.push_back({impact.a, impact.b});
+            continue;
+        }
+        for(unsigned i : {impact.a, impact.b}){
+            world.x[i] += world.vx[i] * impact.time;
+            world.y[i] += world.vy[i] * impact.time;
+        }
+        Collides(world, impact.a, impact.b);
+        for(unsigned i : {impact.a, impact.b}){
+            world.x[i] += world.vx[i] * (dt - impact.time);
+            world.y[i] += world.vy[i] * (dt - impact.time);
+        }
+    }
+    if(merge){
+        for(const pair<unsigned, unsigned>& p : merges){    // merged bodies still travel the full step
+            moved[p.first] = moved[p.second] = 0;
+        }
+    }
+}
+
+}
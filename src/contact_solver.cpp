@@ -0,0 +1,128 @@
+#include "contact_solver.h"
+#include "gravity.h"
+#include "parallel.h"
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+
+namespace gravity{
+
+static const int MAX_COLORS = 64;
+
+void ContactSolverState::gather(const World& world, const vector<pair<unsigned, unsigned>>& candidates){
+    contacts.clear();
+    for(const pair<unsigned, unsigned>& candidate : candidates){
+        unsigned a = candidate.first, b = candidate.second;
+        float dx = world.x[b] - world.x[a];
+        float dy = world.y[b] - world.y[a];
+        world.config.boundary.minimumImage(dx, dy);
+        float distance = sqrt(dx * dx + dy * dy);
+        if(distance > world.radius[a] + world.radius[b] || distance == 0){
+            continue;
+        }
+        Contact contact;
+        contact.a = a;
+        contact.b = b;
+        contact.normalX = dx / distance;
+        contact.normalY = dy / distance;
+        contact.penetration = world.radius[a] + world.radius[b] - distance;
+        contact.effectiveMass = 1 / (1 / world.mass[a] + 1 / world.mass[b]);
+        float approach = (world.vx[a] - world.vx[b]) * contact.normalX + (world.vy[a] - world.vy[b]) * contact.normalY;
+        contact.targetVelocity = approach > 0 ? world.config.restitution * approach : 0.0f;
+        contact.impulse = 0.0f;
+        contacts.push_back(contact);
+    }
+}
+
+void ContactSolverState::color(size_t bodies, Arena& arena){
+    bodyColors.assign(bodies, 0);
+    ArenaVector<int> colorOf = MakeArenaVector<int>(arena, contacts.size());
+    int colors = 0;
+    for(size_t c = 0; c < contacts.size(); c++){
+        uint64_t used = bodyColors[contacts[c].a] | bodyColors[contacts[c].b];
+        int chosen = MAX_COLORS - 1;    // the last batch takes any overflow and is solved serially
+        for(int k = 0; k < MAX_COLORS - 1; k++){
+            if(!(used & (uint64_t(1) << k))){
+                chosen = k;
+                break;
+            }
+        }
+        if(chosen < MAX_COLORS - 1){
+            bodyColors[contacts[c].a] |= uint64_t(1) << chosen;
+            bodyColors[contacts[c].b] |= uint64_t(1) << chosen;
+        }
+        colorOf[c] = chosen;
+        colors = max(colors, chosen + 1);
+    }
+    batchStart.assign(colors + 1, 0);   // counting sort by color, stable in contact order
+    for(int c : colorOf){
+        batchStart[c + 1]++;
+    }
+    for(int c = 0; c < colors; c++){
+        batchStart[c + 1] += batchStart[c];
+    }
+    sorted.resize(contacts.size());
+    unsigned* fill = arena.allocateArray<unsigned>(batchStart.size() - 1);
+    copy(batchStart.begin(), batchStart.end() - 1, fill);
+    for(size_t c = 0; c < contacts.size(); c++){
+        sorted[fill[colorOf[c]]++] = contacts[c];
+    }
+    contacts.swap(sorted);
+}
+
+void ContactSolverState::solve(World& world, const vector<pair<unsigned, unsigned>>& candidates){
+    gather(world, candidates);
+    if(contacts.empty()){
+        return;
+    }
+    color(world.size(), world.arenas().local(0));
+    ThreadPool& pool = world.threadPool();
+    size_t batches = batchStart.size() - 1;
+
+    auto forEachBatch = [&](auto&& resolve){
+        for(size_t batch = 0; batch < batches; batch++){
+            size_t first = batchStart[batch], count = batchStart[batch + 1] - first;
+            if(batch == MAX_COLORS - 1){    // overflow batch may share bodies
+                resolve(first, first + count);
+                continue;
+            }
+            pool.run(count, [&](size_t begin, size_t end, unsigned){
+                resolve(first + begin, first + end);
+            }, 64);
+        }
+    };
+
+    for(int iteration = 0; iteration < world.config.solverIterations; iteration++){
+        forEachBatch([&](size_t begin, size_t end){
+            for(size_t c = begin; c < end; c++){
+                Contact& contact = contacts[c];
+                unsigned a = contact.a, b = contact.b;
+                float approach = (world.vx[a] - world.vx[b]) * contact.normalX + (world.vy[a] - world.vy[b]) * contact.normalY;
+                float delta = (approach + contact.targetVelocity) * contact.effectiveMass;
+                float accumulated = max(contact.impulse + delta, 0.0f);    // contacts push, never pull
+                delta = accumulated - contact.impulse;
+                contact.impulse = accumulated;
+                world.vx[a] -= delta * contact.normalX / world.mass[a];
+                world.vy[a] -= delta * contact.normalY / world.mass[a];
+                world.vx[b] += delta * contact.normalX / world.mass[b];
+                world.vy[b] += delta * contact.normalY / world.mass[b];
+            }
+        });
+    }
+
+    forEachBatch([&](size_t begin, size_t end){    // same positional correction as Collides
+        for(size_t c = begin; c < end; c++){
+            const Contact& contact = contacts[c];
+            float correctionPercent = 0.98f;
+            float slop = 0.001f;
+            float correction = max(contact.penetration - slop, 0.0f) * correctionPercent * contact.effectiveMass;
+            world.x[contact.a] -= contact.normalX * correction / world.mass[contact.a];
+            world.y[contact.a] -= contact.normalY * correction / world.mass[contact.a];
+            world.x[contact.b] += contact.normalX * correction / world.mass[contact.b];
+            world.y[contact.b] += contact.normalY * correction / world.mass[contact.b];
+        }
+    });
+}
+
+}
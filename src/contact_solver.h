@@ -0,0 +1,44 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace gravity{
+
+class World;
+class Arena;
+
+enum class ContactSolver{
+    Sequential,     // resolve each touching pair as soon as it is found, in pair order
+    Parallel,       // gather all contacts, then iterate over independent batches, see below
+};
+
+// Resolves all contacts of a step together with projected Gauss-Seidel. Contacts are
+// greedily graph-colored so no two in a batch share a body; a batch is solved in parallel
+// and batches run one after another. The coloring only depends on the contact order,
+// so results are the same for any thread count.
+class ContactSolverState{
+public:
+    void solve(World& world, const std::vector<std::pair<unsigned, unsigned>>& candidates);
+
+private:
+    struct Contact{
+        unsigned a, b;
+        float normalX, normalY;     // from a to b
+        float penetration;
+        float effectiveMass;        // 1 / (1/ma + 1/mb)
+        float targetVelocity;       // separating speed the restitution asks for
+        float impulse;              // accumulated over the iterations, never pulls
+    };
+
+    void gather(const World& world, const std::vector<std::pair<unsigned, unsigned>>& candidates);
+    void color(size_t bodies, Arena& arena);
+
+    std::vector<Contact> contacts;
+    std::vector<uint64_t> bodyColors;   // bit c set when the body already has a contact of color c
+    std::vector<unsigned> batchStart;   // contacts sorted by color, batch c is [batchStart[c], batchStart[c + 1])
+    std::vector<Contact> sorted;
+};
+
+}
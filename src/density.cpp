@@ -0,0 +1,93 @@
+#include "density.h"
+#include "offscreen.h"
+#include "parallel.h"
+#include "snapshot.h"
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+
+namespace gravity{
+
+DensityRenderer::DensityRenderer(unsigned threads) : pool(new ThreadPool(threads)){
+    histograms.resize(pool->size());
+    bandSum.resize(pool->size());
+    bandMaximum.resize(pool->size());
+    bandFilled.resize(pool->size());
+}
+
+DensityRenderer::~DensityRenderer(){}
+
+void DensityRenderer::render(const DrawView& bodies, Image& image){
+    if(image.width != width || image.height != height){
+        width = image.width;
+        height = image.height;
+        for(vector<float>& histogram : histograms){
+            histogram.assign(size_t(width) * height, 0.0f);
+        }
+        density.assign(size_t(width) * height, 0.0f);
+    }
+    float halfWidth = 0.5f * width, halfHeight = 0.5f * height;
+
+    pool->run(bodies.count, [&](size_t begin, size_t end, unsigned thread){
+        float* histogram = histograms[thread].data();
+        const float* mass = bodies.mass;
+        for(size_t i = begin; i < end; i++){
+            int column = int(floor((bodies.x[i] + 1.0f) * halfWidth));
+            int row = int(floor((1.0f - bodies.y[i]) * halfHeight));
+            if(column >= 0 && column < width && row >= 0 && row < height){
+                histogram[size_t(row) * width + column] += mass ? mass[i] : 1.0f;
+            }
+        }
+    }, 1024);
+
+    // sums the histograms a band of rows per thread, and finds the scale for tone mapping
+    fill(bandSum.begin(), bandSum.end(), 0.0);
+    fill(bandMaximum.begin(), bandMaximum.end(), 0.0);
+    fill(bandFilled.begin(), bandFilled.end(), 0);
+    pool->run(size_t(height), [&](size_t begin, size_t end, unsigned thread){
+        size_t first = begin * width, last = end * width;
+        copy(histograms[0].begin() + first, histograms[0].begin() + last, density.begin() + first);
+        fill(histograms[0].begin() + first, histograms[0].begin() + last, 0.0f);
+        for(size_t h = 1; h < histograms.size(); h++){
+            float* histogram = histograms[h].data();
+            for(size_t pixel = first; pixel < last; pixel++){
+                density[pixel] += histogram[pixel];
+                histogram[pixel] = 0.0f;
+            }
+        }
+        double sum = 0.0, maximum = 0.0;
+        size_t filled = 0;
+        for(size_t pixel = first; pixel < last; pixel++){
+            if(density[pixel] > 0.0f){
+                sum += density[pixel];
+                maximum = max(maximum, double(density[pixel]));
+                filled++;
+            }
+        }
+        bandSum[thread] = sum;
+        bandMaximum[thread] = maximum;
+        bandFilled[thread] = filled;
+    });
+    double sum = 0.0, maximum = 0.0;
+    size_t filled = 0;
+    for(size_t t = 0; t < bandSum.size(); t++){
+        sum += bandSum[t];
+        maximum = max(maximum, bandMaximum[t]);
+        filled += bandFilled[t];
+    }
+
+    // log(1 + d / mean) / log(1 + max / mean) through a black, red, yellow, white ramp
+    float inverseMean = filled > 0 ? float(filled / sum) : 1.0f;
+    float inverseTop = 1.0f / log1p(max(1e-6f, float(maximum) * inverseMean));
+    pool->run(size_t(height), [&](size_t begin, size_t end, unsigned){
+        for(size_t pixel = begin * width; pixel < end * width; pixel++){
+            float t = log1p(density[pixel] * inverseMean) * inverseTop * 3.0f;
+            image.rgb[pixel * 3 + 0] = uint8_t(min(1.0f, t) * 255.0f);
+            image.rgb[pixel * 3 + 1] = uint8_t(min(1.0f, max(0.0f, t - 1.0f)) * 255.0f);
+            image.rgb[pixel * 3 + 2] = uint8_t(min(1.0f, max(0.0f, t - 2.0f)) * 255.0f);
+        }
+    });
+}
+
+}
@@ -0,0 +1,39 @@
+#pragma once
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+namespace gravity{
+
+struct DrawView;
+struct Image;
+class ThreadPool;
+
+// Level-of-detail renderer for views with far more bodies than pixels, where drawing
+// every body as a disc costs a lot and shows nothing. Each body adds its mass (1 when
+// there are no masses) to the pixel under its center, and the totals are tone-mapped
+// on a logarithmic scale, so dense cores and faint outskirts show up in one picture.
+//
+// Every thread sums its slice of the bodies into a histogram of its own, so no two
+// threads write the same memory. The histograms are then added up a band of rows per
+// thread and cleared for the next frame on the way.
+class DensityRenderer{
+public:
+    explicit DensityRenderer(unsigned threads = 1);
+    ~DensityRenderer();
+    DensityRenderer(const DensityRenderer&) = delete;
+    DensityRenderer& operator=(const DensityRenderer&) = delete;
+
+    // Draws bodies into image, [-1, 1] spanning it as in the window. Keeps image's size.
+    void render(const DrawView& bodies, Image& image);
+
+private:
+    std::unique_ptr<ThreadPool> pool;
+    int width = 0, height = 0;
+    std::vector<std::vector<float>> histograms;     // one per thread
+    std::vector<float> density;                     // their sum
+    std::vector<double> bandSum, bandMaximum;       // per thread, over its band of rows
+    std::vector<size_t> bandFilled;
+};
+
+}
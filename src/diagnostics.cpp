@@ -0,0 +1,110 @@
+#include "diagnostics.h"
+#include "gravity.h"
+#include <cmath>
+#include <iostream>
+
+using namespace std;
+
+namespace gravity{
+
+static const int SAMPLE_FIELDS = 11;
+
+Diagnostics::Diagnostics(const DiagnosticsConfig& config) : config(config){
+    if(config.path.empty()){
+        return;
+    }
+    bool binary = config.format == DiagnosticsFormat::Binary;
+    out.open(config.path, binary ? ios::binary | ios::out : ios::out);
+    if(!out){
+        cerr<<"failed to open diagnostics file "<<config.path<<endl;
+        return;
+    }
+    if(binary){
+        uint32_t fields = SAMPLE_FIELDS;
+        out.write("GDIA", 4);
+        out.write(reinterpret_cast<const char*>(&fields), sizeof(fields));
+    }
+    else{
+        out<<"step,time,kinetic,potential,total,momentum_x,momentum_y,angular_momentum,"
+           <<"energy_drift,momentum_drift,angular_momentum_drift\n";
+    }
+}
+
+uint64_t HashBytes(uint64_t hash, const void* data, size_t bytes){
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    for(size_t k = 0; k < bytes; k++){
+        hash = (hash ^ p[k]) * 1099511628211ull;
+    }
+    return hash;
+}
+
+uint64_t StateHash(const World& world){
+    uint64_t hash = FNV_OFFSET;
+    auto add = [&](const void* data, size_t bytes){ hash = HashBytes(hash, data, bytes); };
+    add(&world.stepCount, sizeof(world.stepCount));
+    add(&world.time, sizeof(world.time));
+    for(uint32_t bodyId = 0; bodyId < world.indexOfId.size(); bodyId++){
+        size_t i = world.indexOf(bodyId);
+        if(i == World::NO_BODY){
+            continue;
+        }
+        float values[6] = {world.x[i], world.y[i], world.vx[i], world.vy[i], world.mass[i], world.radius[i]};
+        add(&bodyId, sizeof(bodyId));
+        add(values, sizeof(values));
+        add(&world.asleep[i], 1);
+    }
+    return hash;
+}
+
+void Diagnostics::record(const World& world){
+    DiagnosticsSample sample;
+    sample.step = world.stepCount;
+    sample.time = world.time;
+    double speedSum = 0.0;
+    for(size_t i = 0; i < world.size(); i++){
+        double m = world.mass[i], vx = world.vx[i], vy = world.vy[i];
+        sample.kinetic += 0.5 * m * (vx * vx + vy * vy);
+        sample.potential += 0.5 * m * world.potential[i];   // every pair is counted from both ends
+        sample.momentumX += m * vx;
+        sample.momentumY += m * vy;
+        sample.angularMomentum += m * (world.x[i] * vy - world.y[i] * vx);
+        speedSum += m * sqrt(vx * vx + vy * vy);
+    }
+    sample.total = sample.kinetic + sample.potential;
+
+    if(!haveFirst){
+        first = sample;
+        momentumScale = speedSum;
+        haveFirst = true;
+    }
+    if(first.total != 0.0){
+        sample.energyDrift = (sample.total - first.total) / fabs(first.total);
+    }
+    sample.momentumDrift = hypot(sample.momentumX - first.momentumX, sample.momentumY - first.momentumY);
+    if(momentumScale != 0.0){
+        sample.momentumDrift /= momentumScale;
+    }
+    if(first.angularMomentum != 0.0){
+        sample.angularMomentumDrift = (sample.angularMomentum - first.angularMomentum) / fabs(first.angularMomentum);
+    }
+    latest = sample;
+
+    if(!out.is_open()){
+        return;
+    }
+    double fields[SAMPLE_FIELDS] = {double(sample.step), sample.time, sample.kinetic, sample.potential, sample.total,
+        sample.momentumX, sample.momentumY, sample.angularMomentum,
+        sample.energyDrift, sample.momentumDrift, sample.angularMomentumDrift};
+    if(config.format == DiagnosticsFormat::Binary){
+        out.write(reinterpret_cast<const char*>(fields), sizeof(fields));
+    }
+    else{
+        out.precision(17);
+        for(int f = 0; f < SAMPLE_FIELDS; f++){
+            out<<fields[f]<<(f + 1 < SAMPLE_FIELDS ? ',' : '\n');
+        }
+    }
+    out.flush();
+}
+
+}
@@ -0,0 +1,60 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <string>
+
+namespace gravity{
+
+class World;
+
+enum class DiagnosticsFormat{
+    Csv,    // one text line per sample with a header row
+    Binary, // "GDIA" magic, field count, then one record of doubles per sample
+};
+
+struct DiagnosticsConfig{
+    unsigned interval = 0;      // sample every this many steps, 0 turns diagnostics off
+    std::string path;           // where samples are streamed, nothing is written when empty
+    DiagnosticsFormat format = DiagnosticsFormat::Csv;
+};
+
+// Conserved quantities at one instant, and how far they moved since the first sample.
+struct DiagnosticsSample{
+    uint64_t step = 0;
+    double time = 0.0;
+    double kinetic = 0.0, potential = 0.0, total = 0.0;
+    double momentumX = 0.0, momentumY = 0.0;
+    double angularMomentum = 0.0;   // about the origin
+    double energyDrift = 0.0;       // (E - E0) / |E0|
+    double momentumDrift = 0.0;     // |p - p0| / sum of m|v| at the first sample, absolute if that is 0
+    double angularMomentumDrift = 0.0; // (L - L0) / |L0|
+};
+
+// Sampled by step() right after the force pass, which fills the per-body potential
+// with whatever solver is running so no extra pairwise pass is needed.
+class Diagnostics{
+public:
+    explicit Diagnostics(const DiagnosticsConfig& config);
+
+    void record(const World& world);
+    const DiagnosticsSample& last() const{ return latest; }
+
+private:
+    DiagnosticsConfig config;
+    std::ofstream out;
+    bool haveFirst = false;
+    DiagnosticsSample first, latest;
+    double momentumScale = 0.0;
+};
+
+// Folds bytes into a 64 bit FNV-1a hash. Start from FNV_OFFSET.
+const uint64_t FNV_OFFSET = 14695981039346656037ull;
+uint64_t HashBytes(uint64_t hash, const void* data, size_t bytes);
+
+// 64 bit FNV-1a hash of the step count, the time and the exact bits of every body's id,
+// position, velocity, mass, radius and sleep flag, taken in id order so reordering the arrays does
+// not change it. Two runs that agree on it after every step computed the same thing.
+uint64_t StateHash(const World& world);
+
+}
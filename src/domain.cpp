@@ -0,0 +1,431 @@
+#include "domain.h"
+#include "kernels.h"
+#include "parallel.h"
+#include "profiler.h"
+#include "spatial_sort.h"
+#include "transport.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+using namespace std;
+
+namespace gravity{
+
+// Point mass in a ghost or summary list.
+struct PointMass{
+    float x, y, mass;
+};
+
+template<class T> static void Append(vector<char>& message, const T* values, size_t count){
+    size_t at = message.size();
+    message.resize(at + count * sizeof(T));
+    if(count){
+        memcpy(message.data() + at, values, count * sizeof(T));
+    }
+}
+
+template<class T> static void Append(vector<char>& message, const T& value){
+    Append(message, &value, 1);
+}
+
+// Reads values back in the order they were appended.
+class MessageReader{
+public:
+    explicit MessageReader(const vector<char>& message) : message(message){}
+
+    template<class T> T read(){
+        T value;
+        memcpy(&value, message.data() + at, sizeof(T));
+        at += sizeof(T);
+        return value;
+    }
+    bool done() const{ return at >= message.size(); }
+
+private:
+    const vector<char>& message;
+    size_t at = 0;
+};
+
+static BodyRecord Record(const World& world, size_t i){
+    return {world.id[i], world.x[i], world.y[i], world.vx[i], world.vy[i], world.ax[i], world.ay[i],
+        world.mass[i], world.radius[i], world.red[i], world.green[i], world.blue[i]};
+}
+
+static void AddRecord(World& world, const BodyRecord& r){
+    world.addBody(Object(r.radius, {r.x, r.y}, r.mass, {r.vx, r.vy}, {r.red, r.green, r.blue}, {r.ax, r.ay}), r.id);
+}
+
+Domain::Domain(Transport& transport, const World& initial, const DomainConfig& config)
+    : transport(transport), config(config), world(initial){
+    int ranks = transport.size();
+    outgoing.resize(ranks);
+    if(!partition()){   // every rank holds every body here, so nothing has to move, only be dropped
+        return;
+    }
+    vector<uint8_t> keep(world.size());
+    for(size_t i = 0; i < world.size(); i++){
+        keep[i] = owner(key(world.x[i], world.y[i])) == transport.rank();
+    }
+    world.compact(keep.data());
+}
+
+uint32_t Domain::key(float x, float y) const{
+    float u = min(65535.0f, max(0.0f, (x - originX) * scale));
+    float v = min(65535.0f, max(0.0f, (y - originY) * scale));
+    return MortonCode(uint32_t(u), uint32_t(v));
+}
+
+int Domain::owner(uint32_t key) const{
+    return int(upper_bound(rangeStart.begin(), rangeStart.end(), uint64_t(key)) - rangeStart.begin()) - 1;
+}
+
+bool Domain::exchange(){
+    connected = connected && transport.exchange(outgoing, incoming);
+    return connected;
+}
+
+bool Domain::partition(){
+    int ranks = transport.size();
+
+    // bounding box of all bodies
+    float box[4] = {INFINITY, INFINITY, -INFINITY, -INFINITY};
+    for(size_t i = 0; i < world.size(); i++){
+        box[0] = min(box[0], world.x[i]);
+        box[1] = min(box[1], world.y[i]);
+        box[2] = max(box[2], world.x[i]);
+        box[3] = max(box[3], world.y[i]);
+    }
+    for(int r = 0; r < ranks; r++){
+        outgoing[r].clear();
+        Append(outgoing[r], box, 4);
+    }
+    if(!exchange()){
+        return false;
+    }
+    for(int r = 0; r < ranks; r++){
+        MessageReader reader(incoming[r]);
+        box[0] = min(box[0], reader.read<float>());
+        box[1] = min(box[1], reader.read<float>());
+        box[2] = max(box[2], reader.read<float>());
+        box[3] = max(box[3], reader.read<float>());
+    }
+    if(box[0] <= box[2]){
+        float extent = max(max(box[2] - box[0], box[3] - box[1]), 1e-20f);
+        originX = box[0] - 0.01f * extent;      // a little room, so bodies stay inside until the next partition
+        originY = box[1] - 0.01f * extent;
+        scale = 65535.0f / (1.02f * extent);
+    }
+
+    // cut the curve where the cumulative body count crosses each rank's share
+    const int BIN_BITS = 12;
+    vector<uint32_t> histogram(size_t(1) << BIN_BITS, 0);
+    for(size_t i = 0; i < world.size(); i++){
+        histogram[key(world.x[i], world.y[i]) >> (32 - BIN_BITS)]++;
+    }
+    for(int r = 0; r < ranks; r++){
+        outgoing[r].clear();
+        Append(outgoing[r], histogram.data(), histogram.size());
+    }
+    if(!exchange()){
+        return false;
+    }
+    fill(histogram.begin(), histogram.end(), 0);
+    for(int r = 0; r < ranks; r++){
+        MessageReader reader(incoming[r]);
+        for(uint32_t& count : histogram){
+            count += reader.read<uint32_t>();
+        }
+    }
+    uint64_t total = 0;
+    for(uint32_t count : histogram){
+        total += count;
+    }
+    rangeStart.assign(ranks + 1, uint64_t(1) << 32);
+    rangeStart[0] = 0;
+    uint64_t seen = 0;
+    int next = 1;
+    for(size_t bin = 0; bin < histogram.size() && next < ranks; bin++){
+        while(next < ranks && seen >= total * next / ranks){
+            rangeStart[next++] = uint64_t(bin) << (32 - BIN_BITS);
+        }
+        seen += histogram[bin];
+    }
+    return true;
+}
+
+bool Domain::migrate(){
+    int ranks = transport.size(), me = transport.rank();
+    for(int r = 0; r < ranks; r++){
+        outgoing[r].clear();
+    }
+    vector<uint8_t> keep(world.size(), 1);
+    bool leaving = false;
+    for(size_t i = 0; i < world.size(); i++){
+        int to = owner(key(world.x[i], world.y[i]));
+        if(to != me){
+            Append(outgoing[to], Record(world, i));
+            keep[i] = 0;
+            leaving = true;
+        }
+    }
+    if(leaving){
+        world.compact(keep.data());
+    }
+    if(!exchange()){
+        return false;
+    }
+    for(int r = 0; r < ranks; r++){
+        if(r == me){
+            continue;
+        }
+        MessageReader reader(incoming[r]);
+        while(!reader.done()){
+            AddRecord(world, reader.read<BodyRecord>());
+        }
+    }
+    return true;
+}
+
+bool Domain::exchangeBoundary(){
+    int ranks = transport.size(), me = transport.rank();
+    size_t n = world.size();
+    const Boundary& boundary = world.config.boundary;
+
+    // where every rank's bodies are
+    float box[4] = {INFINITY, INFINITY, -INFINITY, -INFINITY};
+    for(size_t i = 0; i < n; i++){
+        box[0] = min(box[0], world.x[i]);
+        box[1] = min(box[1], world.y[i]);
+        box[2] = max(box[2], world.x[i]);
+        box[3] = max(box[3], world.y[i]);
+    }
+    for(int r = 0; r < ranks; r++){
+        outgoing[r].clear();
+        Append(outgoing[r], box, 4);
+    }
+    if(!exchange()){
+        return false;
+    }
+    rankBoxes.resize(4 * ranks);
+    for(int r = 0; r < ranks; r++){
+        MessageReader reader(incoming[r]);
+        for(int k = 0; k < 4; k++){
+            rankBoxes[4 * r + k] = reader.read<float>();
+        }
+    }
+
+    // own bodies by summary cell: the top 2 * level bits of the key
+    unsigned level = min(config.summaryLevel, 10u);
+    size_t cellCount = size_t(1) << (2 * level);
+    Arena& arena = world.arenas().local(0);
+    uint32_t* cellOf = arena.allocateArray<uint32_t>(n);
+    uint32_t* cellStart = arena.allocateArray<uint32_t>(cellCount + 1);
+    uint32_t* cellBodies = arena.allocateArray<uint32_t>(n);
+    fill(cellStart, cellStart + cellCount + 1, 0);
+    for(size_t i = 0; i < n; i++){
+        cellOf[i] = level ? key(world.x[i], world.y[i]) >> (32 - 2 * level) : 0;
+        cellStart[cellOf[i] + 1]++;
+    }
+    for(size_t c = 0; c < cellCount; c++){
+        cellStart[c + 1] += cellStart[c];
+    }
+    uint32_t* fillAt = arena.allocateArray<uint32_t>(cellCount);
+    copy(cellStart, cellStart + cellCount, fillAt);
+    for(size_t i = 0; i < n; i++){
+        cellBodies[fillAt[cellOf[i]]++] = uint32_t(i);
+    }
+
+    // per occupied cell: one point mass, or every body when the receiver is too close
+    for(int r = 0; r < ranks; r++){
+        outgoing[r].clear();
+    }
+    for(int r = 0; r < ranks; r++){
+        const float* to = &rankBoxes[4 * r];
+        if(r == me || to[0] > to[2]){   // nothing to send to a rank without bodies
+            continue;
+        }
+        ghostBytes.clear();
+        summaryBytes.clear();
+        float centerX = 0.5f * (to[0] + to[2]), centerY = 0.5f * (to[1] + to[3]);
+        float halfWidth = 0.5f * (to[2] - to[0]), halfHeight = 0.5f * (to[3] - to[1]);
+        for(size_t c = 0; c < cellCount; c++){
+            if(cellStart[c] == cellStart[c + 1]){
+                continue;
+            }
+            PointMass total = {0.0f, 0.0f, 0.0f};
+            float low[2] = {INFINITY, INFINITY}, high[2] = {-INFINITY, -INFINITY};
+            for(uint32_t k = cellStart[c]; k < cellStart[c + 1]; k++){
+                uint32_t i = cellBodies[k];
+                total.mass += world.mass[i];
+                total.x += world.mass[i] * world.x[i];
+                total.y += world.mass[i] * world.y[i];
+                low[0] = min(low[0], world.x[i]); high[0] = max(high[0], world.x[i]);
+                low[1] = min(low[1], world.y[i]); high[1] = max(high[1], world.y[i]);
+            }
+            if(total.mass == 0.0f){     // only massless tracers, which pull on nothing
+                continue;
+            }
+            total.x /= total.mass;
+            total.y /= total.mass;
+            float dx = total.x - centerX, dy = total.y - centerY;
+            boundary.minimumImage(dx, dy);
+            float gapX = max(0.0f, fabs(dx) - halfWidth), gapY = max(0.0f, fabs(dy) - halfHeight);
+            float gap = sqrt(gapX * gapX + gapY * gapY);
+            float size = max(high[0] - low[0], high[1] - low[1]);
+            if(size < config.openingAngle * gap){
+                Append(summaryBytes, total);
+                continue;
+            }
+            for(uint32_t k = cellStart[c]; k < cellStart[c + 1]; k++){
+                uint32_t i = cellBodies[k];
+                Append(ghostBytes, PointMass{world.x[i], world.y[i], world.mass[i]});
+            }
+        }
+        Append(outgoing[r], uint64_t(ghostBytes.size() / sizeof(PointMass)));
+        Append(outgoing[r], ghostBytes.data(), ghostBytes.size());
+        Append(outgoing[r], summaryBytes.data(), summaryBytes.size());
+    }
+    if(!exchange()){
+        return false;
+    }
+
+    // sized once from the message lengths, so the arrays only ever grow to the largest step
+    size_t ghostTotal = 0, summaryTotal = 0;
+    for(int r = 0; r < ranks; r++){
+        if(r == me || incoming[r].empty()){
+            continue;
+        }
+        uint64_t ghostsFromRank = MessageReader(incoming[r]).read<uint64_t>();
+        ghostTotal += ghostsFromRank;
+        summaryTotal += (incoming[r].size() - sizeof(uint64_t)) / sizeof(PointMass) - ghostsFromRank;
+    }
+    ghostX.resize(ghostTotal); ghostY.resize(ghostTotal); ghostMass.resize(ghostTotal);
+    summaryX.resize(summaryTotal); summaryY.resize(summaryTotal); summaryMass.resize(summaryTotal);
+    size_t ghost = 0, summary = 0;
+    for(int r = 0; r < ranks; r++){
+        if(r == me || incoming[r].empty()){
+            continue;
+        }
+        MessageReader reader(incoming[r]);
+        uint64_t ghostsFromRank = reader.read<uint64_t>();
+        for(uint64_t g = 0; g < ghostsFromRank; g++, ghost++){
+            PointMass p = reader.read<PointMass>();
+            ghostX[ghost] = p.x; ghostY[ghost] = p.y; ghostMass[ghost] = p.mass;
+        }
+        for(; !reader.done(); summary++){
+            PointMass p = reader.read<PointMass>();
+            summaryX[summary] = p.x; summaryY[summary] = p.y; summaryMass[summary] = p.mass;
+        }
+    }
+    return true;
+}
+
+void Domain::computeForces(){
+    ScopedTimer timer(Phase::Force);
+    size_t n = world.size();
+    fill(world.ax.begin(), world.ax.end(), 0.0f);
+    fill(world.ay.begin(), world.ay.end(), 0.0f);
+    allX.assign(world.x.begin(), world.x.end());
+    allY.assign(world.y.begin(), world.y.end());
+    allMass.assign(world.mass.begin(), world.mass.end());
+    allX.insert(allX.end(), ghostX.begin(), ghostX.end());
+    allY.insert(allY.end(), ghostY.begin(), ghostY.end());
+    allMass.insert(allMass.end(), ghostMass.begin(), ghostMass.end());
+
+    const Boundary& boundary = world.config.boundary;
+    float G = world.config.gravitationalConstant;
+    auto image = [&](Vec<2>& d){ boundary.minimumImage(d[0], d[1]); };
+    world.threadPool().run(n, [&](size_t begin, size_t end, unsigned){
+        for(size_t i = begin; i < end; i++){
+            if(world.asleep[i]){
+                continue;
+            }
+            Vec<2> acceleration = {0.0f, 0.0f};
+            // own bodies and ghosts exactly; i is an own body, so the self skip still works
+            if(world.config.kernel == ForceKernel::FastRsqrt){
+                DirectAcceleration<2, ForceKernel::FastRsqrt>(i, allX.size(), {allX.data(), allY.data()}, allMass.data(), G, image, acceleration, nullptr);
+            }
+            else{
+                DirectAcceleration<2>(i, allX.size(), {allX.data(), allY.data()}, allMass.data(), G, image, acceleration, nullptr);
+            }
+            for(size_t s = 0; s < summaryX.size(); s++){
+                Vec<2> d = {summaryX[s] - world.x[i], summaryY[s] - world.y[i]};
+                image(d);
+                float distanceSquared = Dot<2>(d, d);
+                if(distanceSquared == 0.0f){
+                    continue;
+                }
+                float scale = G * summaryMass[s] / (distanceSquared * sqrt(distanceSquared));
+                acceleration[0] += d[0] * scale;
+                acceleration[1] += d[1] * scale;
+            }
+            world.ax[i] = acceleration[0];
+            world.ay[i] = acceleration[1];
+        }
+    }, 16);
+}
+
+bool Domain::step(float dt){
+    BeginStep(world);
+    if(world.stepCount > 0 && config.rebalanceInterval > 0 && world.stepCount % config.rebalanceInterval == 0){
+        if(!partition()){   // the bodies move over to the new ranges in migrate() below
+            return false;
+        }
+    }
+    if(!exchangeBoundary()){
+        return false;
+    }
+    computeForces();
+    Integrate(world, dt);
+    if(world.config.collision != CollisionBackend::None){
+        CollisionDetect(world);
+    }
+    {
+        ScopedTimer timer(Phase::Boundary);
+        ApplyBoundary(world);
+    }
+    world.stepCount++;
+    world.time += dt;
+    ScopedTimer timer(Phase::IO);
+    return migrate();
+}
+
+bool Domain::gather(World& all){
+    int ranks = transport.size(), me = transport.rank();
+    for(int r = 0; r < ranks; r++){
+        outgoing[r].clear();
+    }
+    if(me != 0){
+        for(size_t i = 0; i < world.size(); i++){
+            Append(outgoing[0], Record(world, i));
+        }
+    }
+    if(!exchange()){
+        return false;
+    }
+    if(me != 0){
+        return true;
+    }
+    vector<BodyRecord>& records = gatherRecords;
+    records.clear();
+    for(size_t i = 0; i < world.size(); i++){
+        records.push_back(Record(world, i));
+    }
+    for(int r = 1; r < ranks; r++){
+        MessageReader reader(incoming[r]);
+        while(!reader.done()){
+            records.push_back(reader.read<BodyRecord>());
+        }
+    }
+    sort(records.begin(), records.end(), [](const BodyRecord& a, const BodyRecord& b){ return a.id < b.id; });
+    all.clear();
+    for(const BodyRecord& record : records){
+        AddRecord(all, record);
+    }
+    all.stepCount = world.stepCount;
+    all.time = world.time;
+    return true;
+}
+
+}
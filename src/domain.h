@@ -0,0 +1,80 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "gravity.h"
+
+namespace gravity{
+
+class Transport;
+
+// What travels when a body changes rank or is gathered.
+struct BodyRecord{
+    uint32_t id;
+    float x, y, vx, vy, ax, ay;
+    float mass, radius, red, green, blue;
+};
+
+struct DomainConfig{
+    float openingAngle = 0.5f;      // a remote cell smaller than this times its distance arrives as one point mass
+    unsigned summaryLevel = 6;      // remote bodies are summarized in 2^level by 2^level cells, at most 10
+    unsigned rebalanceInterval = 50;    // steps between recomputing who owns which part of space
+};
+
+// One rank's part of a simulation split across processes. Space is cut into ranges of
+// the Morton curve over the bodies' bounding box, each holding about the same number of
+// bodies, and every rank owns and steps the bodies in its range.
+//
+// Before each force pass the ranks exchange what they need from each other. A rank
+// sorts its bodies into summary cells. A cell far from another rank's bodies, compared
+// with its size, goes there as a single point mass; a near one goes body by body as
+// ghosts. Ghosts pull but are never moved. After the step, bodies that crossed into
+// another range move to their new owner.
+//
+// Collisions and the boundary only see a rank's own bodies, so two bodies on different
+// ranks pass through each other.
+class Domain{
+public:
+    // Every rank passes the same initial world and keeps the bodies it owns.
+    Domain(Transport& transport, const World& initial, const DomainConfig& config = DomainConfig());
+
+    // False once another rank went away, which nothing can recover from; step and gather
+    // return it too. The caller stops the run.
+    bool ok() const{ return connected; }
+
+    World& local(){ return world; }     // the bodies this rank owns
+    bool step(float dt);
+
+    // Collects the bodies of every rank into all on rank 0, in id order. Every rank has to call it.
+    bool gather(World& all);
+
+    size_t ghostCount() const{ return ghostX.size(); }
+    size_t summaryCount() const{ return summaryX.size(); }
+
+private:
+    uint32_t key(float x, float y) const;
+    int owner(uint32_t key) const;
+    bool exchange();        // outgoing to incoming through the transport, false if that failed
+    bool partition();       // new key frame and ranges from every rank's bodies
+    bool migrate();         // sends bodies outside this rank's range to their owners
+    bool exchangeBoundary();
+    void computeForces();
+
+    Transport& transport;
+    DomainConfig config;
+    World world;
+    bool connected = true;
+
+    float originX = 0.0f, originY = 0.0f, scale = 1.0f;    // maps positions to 16 bit key coordinates
+    std::vector<uint64_t> rangeStart;   // rank r owns keys in [rangeStart[r], rangeStart[r + 1])
+
+    std::vector<float> ghostX, ghostY, ghostMass;
+    std::vector<float> summaryX, summaryY, summaryMass;
+    std::vector<float> allX, allY, allMass;     // own bodies followed by the ghosts
+    std::vector<std::vector<char>> outgoing, incoming;
+    std::vector<float> rankBoxes;               // every rank's bounding box, 4 floats each
+    std::vector<char> ghostBytes, summaryBytes; // what goes to one rank, before it is framed
+    std::vector<BodyRecord> gatherRecords;      // rank 0's gather, sorted by id before it goes into the world
+};
+
+}
@@ -0,0 +1,53 @@
+#include "ensemble.h"
+#include "kernels.h"
+
+using namespace std;
+
+namespace gravity{
+
+static const size_t LANES_PER_CACHE_LINE = 16;  // keeps threads from sharing cache lines
+
+Ensemble::Ensemble(const World& prototype, size_t systems) : prototype(prototype){
+    gravitationalConstant = prototype.config.gravitationalConstant;
+    systemCount = systems;
+    bodyCount = prototype.size();
+    for(vector<float>* array : {&x, &y, &vx, &vy, &ax, &ay, &mass}){
+        array->assign(bodyCount * systemCount, 0.0f);
+    }
+    for(size_t b = 0; b < bodyCount; b++){
+        for(size_t s = 0; s < systemCount; s++){
+            x[index(b, s)] = prototype.x[b];
+            y[index(b, s)] = prototype.y[b];
+            vx[index(b, s)] = prototype.vx[b];
+            vy[index(b, s)] = prototype.vy[b];
+            mass[index(b, s)] = prototype.mass[b];
+        }
+    }
+}
+
+World Ensemble::extract(size_t system) const{
+    World world = prototype;
+    for(size_t b = 0; b < bodyCount; b++){
+        world.x[b] = x[index(b, system)];
+        world.y[b] = y[index(b, system)];
+        world.vx[b] = vx[index(b, system)];
+        world.vy[b] = vy[index(b, system)];
+        world.ax[b] = ax[index(b, system)];
+        world.ay[b] = ay[index(b, system)];
+        world.mass[b] = mass[index(b, system)];
+    }
+    return world;
+}
+
+void Ensemble::stepSystems(size_t begin, size_t end, float dt){
+    SelectLaneStepper<2>(bodyCount)({x.data(), y.data()}, {vx.data(), vy.data()}, {ax.data(), ay.data()},
+        mass.data(), bodyCount, systemCount, begin, end, gravitationalConstant, dt);
+}
+
+void Ensemble::step(float dt, ThreadPool& pool){
+    pool.run(systemCount, [&](size_t begin, size_t end, unsigned){
+        stepSystems(begin, end, dt);
+    }, LANES_PER_CACHE_LINE);
+}
+
+}
@@ -0,0 +1,42 @@
+#pragma once
+#include <cstddef>
+#include <vector>
+#include "gravity.h"
+#include "parallel.h"
+
+namespace gravity{
+
+// Many small independent systems with the same body count, stepped together. Every
+// array is laid out [body][system], so the system index is the innermost, contiguous
+// lane and the force loop vectorizes across systems instead of across bodies.
+class Ensemble{
+public:
+    float gravitationalConstant;
+
+    std::vector<float> x, y;
+    std::vector<float> vx, vy;
+    std::vector<float> ax, ay;
+    std::vector<float> mass;
+
+    // Copies the bodies of prototype into every one of the `systems` lanes.
+    Ensemble(const World& prototype, size_t systems);
+
+    size_t systems() const{ return systemCount; }
+    size_t bodies() const{ return bodyCount; }
+    size_t index(size_t body, size_t system) const{ return body * systemCount + system; }
+
+    // Builds a standalone World from one lane, using the prototype's radii and colors.
+    World extract(size_t system) const;
+
+    // Gravity and integration for every system. Collisions are not resolved here. Systems
+    // of up to 16 bodies run a kernel compiled for exactly their body count.
+    void step(float dt, ThreadPool& pool);
+
+private:
+    void stepSystems(size_t begin, size_t end, float dt);
+
+    size_t systemCount, bodyCount;
+    World prototype;
+};
+
+}
@@ -0,0 +1,343 @@
+#include "gravity.h"
+#include "kernels.h"
+#include "numa.h"
+#include "parallel.h"
+#include "profiler.h"
+#include <cmath>
+#include <algorithm>
+#include <type_traits>
+
+using namespace std;
+
+namespace gravity{
+
+Workspace::Workspace() = default;
+Workspace::Workspace(const Workspace&){}
+Workspace& Workspace::operator=(const Workspace&){ return *this; }
+Workspace::~Workspace() = default;
+
+ThreadPool& World::threadPool(){
+    if(!workspace.pool || workspace.pool->size() != max(1u, config.threads) || workspace.pool->pinned() != config.numa){
+        workspace.pool.reset();     // the old threads go first, so the new ones can be pinned from this thread
+        workspace.pool.reset(new ThreadPool(config.threads, config.numa));
+    }
+    return *workspace.pool;
+}
+
+StepArenas& World::arenas(){
+    if(!workspace.arenas){
+        workspace.arenas.reset(new StepArenas());
+    }
+    workspace.arenas->resize(threadPool().size());
+    return *workspace.arenas;
+}
+
+void World::placeOnNodes(){
+    ThreadPool& pool = threadPool();
+    // the same slices as the force pass, each placed by the thread that works on it
+    pool.run(size(), [&](size_t begin, size_t end, unsigned thread){
+        forEachArray([&](auto& array){
+            PlaceOnNode(array.data() + begin, (end - begin) * sizeof(array[0]), pool.node(thread));
+        });
+    });
+    workspace.placedArrays = x.data();
+    workspace.placedBodies = size();
+}
+
+size_t World::addBody(const Object& object){
+    return addBody(object, nextId);
+}
+
+size_t World::addBody(const Object& object, uint32_t bodyId){
+    x.push_back(object.center[0]);
+    y.push_back(object.center[1]);
+    vx.push_back(object.velocity[0]);
+    vy.push_back(object.velocity[1]);
+    ax.push_back(object.acceleration[0]);
+    ay.push_back(object.acceleration[1]);
+    mass.push_back(object.massKg);
+    radius.push_back(object.radius);
+    red.push_back(object.color[0]);
+    green.push_back(object.color[1]);
+    blue.push_back(object.color[2]);
+    id.push_back(bodyId);
+    asleep.push_back(0);
+    stillSteps.push_back(0);
+    island.push_back(bodyId);
+    nextId = max(nextId, bodyId + 1);
+    if(indexOfId.size() <= bodyId){
+        indexOfId.resize(bodyId + 1, NO_BODY);
+    }
+    indexOfId[bodyId] = uint32_t(x.size() - 1);
+    return x.size() - 1;
+}
+
+Object World::body(size_t i) const{
+    return Object(radius[i], {x[i], y[i]}, mass[i], {vx[i], vy[i]}, {red[i], green[i], blue[i]}, {ax[i], ay[i]});
+}
+
+void World::clear(){
+    forEachArray([](auto& array){ array.clear(); });
+    fill(indexOfId.begin(), indexOfId.end(), NO_BODY);
+    layoutVersion++;
+}
+
+void World::compact(const uint8_t* keep){
+    forEachArray([&](auto& array){
+        size_t kept = 0;
+        for(size_t i = 0; i < array.size(); i++){
+            if(keep[i]){
+                array[kept++] = array[i];
+            }
+        }
+        array.resize(kept);
+    });
+    fill(indexOfId.begin(), indexOfId.end(), NO_BODY);
+    for(size_t i = 0; i < id.size(); i++){
+        indexOfId[id[i]] = uint32_t(i);
+    }
+    layoutVersion++;
+}
+
+void World::permute(const uint32_t* order){
+    ThreadPool& pool = threadPool();
+    Arena& arena = arenas().local(0);
+    size_t n = size();
+    forEachArray([&](auto& array){
+        using T = typename remove_reference<decltype(array)>::type::value_type;
+        T* moved = arena.allocateArray<T>(n);
+        pool.run(n, [&](size_t begin, size_t end, unsigned){
+            for(size_t i = begin; i < end; i++){
+                moved[i] = array[order[i]];
+            }
+        });
+        copy(moved, moved + n, array.begin());
+    });
+    for(size_t i = 0; i < id.size(); i++){
+        indexOfId[id[i]] = uint32_t(i);
+    }
+    layoutVersion++;
+}
+
+void Collides(World& world, size_t a, size_t b){
+    Vec<2> d = {world.x[b] - world.x[a], world.y[b] - world.y[a]};
+    world.config.boundary.minimumImage(d[0], d[1]);
+    BounceBodies<2>({world.x.data(), world.y.data()}, {world.vx.data(), world.vy.data()}, world.mass.data(), world.radius.data(),
+        a, b, d, world.config.restitution);
+}
+
+// Pairs whose bounding boxes overlap, or with the neighbor list, every pair within reach
+// of touching.
+static void BroadPhase(World& world, vector<pair<unsigned, unsigned>>& candidates){
+    size_t n = world.size();
+    // the sweep works on unwrapped coordinates, so periodic boxes keep the brute force search
+    bool sweep = world.config.collision == CollisionBackend::SweepAndPrune && world.config.boundary.kind != BoundaryKind::Periodic;
+    bool cached = world.config.collision == CollisionBackend::NeighborList;
+    if(sweep || cached){
+        if(cached){
+            if(!world.workspace.neighborList){
+                world.workspace.neighborList.reset(new NeighborList());
+            }
+            world.workspace.neighborList->update(world, 0.0f, true, world.config.neighborSkin);
+            const vector<pair<unsigned, unsigned>>& pairs = world.workspace.neighborList->pairs();
+            candidates.assign(pairs.begin(), pairs.end());
+        }
+        else{
+            if(!world.workspace.sweepAndPrune){
+                world.workspace.sweepAndPrune.reset(new SweepAndPrune());
+            }
+            world.workspace.sweepAndPrune->findPairs(world, candidates);
+        }
+        if(world.config.sleep.enabled){
+            candidates.erase(remove_if(candidates.begin(), candidates.end(), [&](const pair<unsigned, unsigned>& p){
+                return world.asleep[p.first] && world.asleep[p.second];
+            }), candidates.end());
+        }
+        return;
+    }
+    candidates.clear();
+    for(size_t i = 0; i < n; i++){
+        for(size_t j = i + 1; j < n; j++){  // each pair once
+            if(world.asleep[i] && world.asleep[j]){
+                continue;
+            }
+            float dx = world.x[j] - world.x[i];
+            float dy = world.y[j] - world.y[i];
+            world.config.boundary.minimumImage(dx, dy);
+            float reach = world.radius[i] + world.radius[j];
+            if(fabs(dx) <= reach && fabs(dy) <= reach){
+                candidates.push_back({unsigned(i), unsigned(j)});
+            }
+        }
+    }
+}
+
+static void NarrowPhase(World& world, const vector<pair<unsigned, unsigned>>& candidates){
+    bool merge = world.config.response == CollisionResponse::Merge;
+    if(!merge && world.config.solver == ContactSolver::Parallel){
+        if(!world.workspace.contactSolver){
+            world.workspace.contactSolver.reset(new ContactSolverState());
+        }
+        world.workspace.contactSolver->solve(world, candidates);
+        return;
+    }
+    vector<pair<unsigned, unsigned>>& merges = world.workspace.merges;
+    merges.clear();
+    for(const pair<unsigned, unsigned>& candidate : candidates){
+        size_t i = candidate.first, j = candidate.second;
+        float dx = world.x[j] - world.x[i];
+        float dy = world.y[j] - world.y[i];
+        world.config.boundary.minimumImage(dx, dy);
+        float distance = sqrt(dx * dx + dy * dy);
+        if(distance > world.radius[i] + world.radius[j]){
+            continue;
+        }
+        if(merge){
+            merges.push_back(candidate);    // deferred, so the pair loop never sees a body disappear
+        }
+        else if(distance != 0){
+            Collides(world, i, j);
+        }
+    }
+    if(!merges.empty()){
+        MergeBodies(world, merges);
+    }
+}
+
+void CollisionDetect(World& world){
+    vector<pair<unsigned, unsigned>>& candidates = world.workspace.candidates;
+    {
+        ScopedTimer timer(Phase::BroadPhase);
+        BroadPhase(world, candidates);
+    }
+    ScopedTimer timer(Phase::NarrowPhase);
+    NarrowPhase(world, candidates);
+    if(world.config.sleep.enabled && world.config.response == CollisionResponse::Bounce){
+        UpdateSleeping(world, candidates);
+    }
+}
+
+static void NearGravity(World& world, size_t i){
+    bool asleep = world.asleep[i] != 0;     // still pulls on the others, but nothing moves it
+    if(asleep && !world.computePotential){
+        return;
+    }
+    const Boundary& boundary = world.config.boundary;
+    auto image = [&](Vec<2>& d){ boundary.minimumImage(d[0], d[1]); };  // periodic boxes pull toward the nearest image
+    Vec<2> acceleration = {0.0f, 0.0f};
+    float* potential = world.computePotential ? &world.potential[i] : nullptr;
+    if(world.config.kernel == ForceKernel::FastRsqrt){
+        DirectAcceleration<2, ForceKernel::FastRsqrt>(i, world.size(), {world.x.data(), world.y.data()}, world.mass.data(),
+            world.config.gravitationalConstant, image, acceleration, potential);
+    }
+    else{
+        DirectAcceleration<2>(i, world.size(), {world.x.data(), world.y.data()}, world.mass.data(),
+            world.config.gravitationalConstant, image, acceleration, potential);
+    }
+    if(asleep){     // only summed for the potential, which the diagnostics need for every body
+        return;
+    }
+    world.ax[i] += acceleration[0];
+    world.ay[i] += acceleration[1];
+}
+
+void ComputeForces(World& world){
+    ScopedTimer timer(Phase::Force);
+    fill(world.ax.begin(), world.ax.end(), 0.0f);
+    fill(world.ay.begin(), world.ay.end(), 0.0f);
+    if(world.computePotential){
+        world.potential.assign(world.size(), 0.0f);
+    }
+    ThreadPool& pool = world.threadPool();
+    switch(world.config.force){
+    case ForceBackend::Direct:
+        pool.run(world.size(), [&](size_t begin, size_t end, unsigned){    // each body only writes its own acceleration
+            for(size_t i = begin; i < end; i++){
+                NearGravity(world, i);
+            }
+        });
+        break;
+    case ForceBackend::ParticleMesh:
+        if(!world.workspace.mesh){
+            world.workspace.mesh.reset(new ParticleMesh());
+        }
+        world.workspace.mesh->computeForces(world, pool);
+        break;
+    }
+}
+
+void Integrate(World& world, float dt){
+    bool swept = world.config.continuousCollision && world.config.collision != CollisionBackend::None;
+    if(!swept){
+        ScopedTimer timer(Phase::Integrate);
+        KickDrift<2>({world.x.data(), world.y.data()}, {world.vx.data(), world.vy.data()}, {world.ax.data(), world.ay.data()},
+            world.size(), dt, [&](size_t i){ return world.asleep[i] != 0; });
+        return;
+    }
+
+    {
+        ScopedTimer timer(Phase::Integrate);
+        for(size_t i = 0; i < world.size(); i++){
+            if(!world.asleep[i]){
+                world.vx[i] += world.ax[i] * dt;
+                world.vy[i] += world.ay[i] * dt;
+            }
+        }
+    }
+    vector<uint8_t>& moved = world.workspace.moved;
+    SweptCollisions(world, dt, moved);     // moves the bodies that hit something itself
+    {
+        ScopedTimer timer(Phase::Integrate);
+        for(size_t i = 0; i < world.size(); i++){
+            if(!moved[i]){
+                world.x[i] += world.vx[i] * dt;
+                world.y[i] += world.vy[i] * dt;
+            }
+        }
+    }
+    if(!world.workspace.merges.empty()){
+        ScopedTimer timer(Phase::NarrowPhase);
+        MergeBodies(world, world.workspace.merges);
+        world.workspace.merges.clear();
+    }
+}
+
+void BeginStep(World& world){
+    world.arenas().reset();
+}
+
+void step(World& world, float dt){
+    BeginStep(world);
+    if(world.config.numa && (world.workspace.placedArrays != world.x.data() || world.workspace.placedBodies != world.size())){
+        world.placeOnNodes();
+    }
+    if(world.config.reorderInterval > 0 && world.stepCount % world.config.reorderInterval == 0){
+        SortBodies(world);
+    }
+    Diagnostics* diagnostics = nullptr;
+    if(world.config.diagnostics.interval > 0 && world.stepCount % world.config.diagnostics.interval == 0){
+        if(!world.workspace.diagnostics){
+            world.workspace.diagnostics.reset(new Diagnostics(world.config.diagnostics));
+        }
+        diagnostics = world.workspace.diagnostics.get();
+        world.computePotential = true;
+    }
+    ComputeForces(world);   // every body sees the same start-of-step positions
+    if(diagnostics){
+        ScopedTimer timer(Phase::IO);
+        diagnostics->record(world);     // positions and velocities still belong to the same instant here
+        world.computePotential = false;
+    }
+    Integrate(world, dt);
+    if(world.config.collision != CollisionBackend::None){
+        CollisionDetect(world);
+    }
+    {
+        ScopedTimer timer(Phase::Boundary);
+        ApplyBoundary(world);
+    }
+    world.stepCount++;
+    world.time += dt;
+}
+
+}
@@ -0,0 +1,198 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+#include "arena.h"
+#include "boundary.h"
+#include "contact_solver.h"
+#include "diagnostics.h"
+#include "kernels.h"
+#include "neighbor_list.h"
+#include "pm_solver.h"
+#include "spatial_sort.h"
+#include "sweep_prune.h"
+
+// Physics core of the gravity simulation. Nothing in here touches GLFW or OpenGL,
+// so the engine can be embedded in another program and stepped in-process.
+namespace gravity{
+
+enum class ForceBackend{
+    Direct,         // pairwise sum over every other body, O(N^2)
+    ParticleMesh,   // FFT solve on a grid, see pm_solver.h
+};
+
+enum class CollisionBackend{
+    None,       // bodies pass through each other
+    BruteForce, // every pair is tested for overlap, O(N^2)
+    SweepAndPrune,  // sorted intervals along x kept from step to step, see sweep_prune.h
+    NeighborList,   // pairs within the radii plus Config::neighborSkin, rebuilt only when bodies moved far enough, see neighbor_list.h
+};
+
+enum class CollisionResponse{
+    Bounce, // impulse with Config::restitution plus positional correction
+    Merge,  // accretion: touching bodies become one, keeping mass and momentum
+};
+
+// Lets groups of resting bodies drop out of integration and collisions until touched.
+struct SleepConfig{
+    bool enabled = false;
+    float speed = 0.01f;    // bodies slower than this count as resting
+    uint32_t steps = 60;    // how long a whole island has to rest before it sleeps
+};
+
+struct Config{
+    float gravitationalConstant = 0.00000001f;
+    float restitution = 0.9f;       // bounce between two bodies
+    Boundary boundary;
+    ForceBackend force = ForceBackend::Direct;
+    CollisionBackend collision = CollisionBackend::BruteForce;
+    CollisionResponse response = CollisionResponse::Bounce;
+    ContactSolver solver = ContactSolver::Sequential;   // how bounces are resolved
+    int solverIterations = 8;       // used by ContactSolver::Parallel
+    SleepConfig sleep;
+    bool continuousCollision = false;   // find hits along each body's path, not just overlaps at the end
+    MeshConfig mesh;                // used by ForceBackend::ParticleMesh
+    unsigned threads = 1;           // worker threads for the force pass
+    bool numa = false;              // pin the threads node by node and move each thread's bodies to its node's memory
+    DiagnosticsConfig diagnostics;  // conservation checks, off unless an interval is set
+    unsigned reorderInterval = 0;   // sort bodies along a space-filling curve every this many steps, 0 never
+    bool deterministic = false;     // results do not depend on config.threads; see StateHash to compare runs
+    float neighborSkin = 0.01f;     // extra reach of the cached pair lists, see NeighborList
+    ForceKernel kernel = ForceKernel::Exact;   // how ForceBackend::Direct evaluates each pair
+};
+
+class ThreadPool;
+
+// Scratch state the backends keep from one step to the next. Copying a World does
+// not copy it; the copy builds its own on first use.
+struct Workspace{
+    std::unique_ptr<ThreadPool> pool;
+    std::unique_ptr<ParticleMesh> mesh;
+    std::unique_ptr<Diagnostics> diagnostics;
+    std::unique_ptr<SweepAndPrune> sweepAndPrune;
+    std::unique_ptr<NeighborList> neighborList;     // used by CollisionBackend::NeighborList
+    std::unique_ptr<ContactSolverState> contactSolver;
+    std::unique_ptr<StepArenas> arenas;     // transient data of the current step, see World::arenas
+    const void* placedArrays = nullptr;     // x.data() and size() when the arrays were last placed on nodes
+    size_t placedBodies = 0;
+    std::vector<std::pair<unsigned, unsigned>> candidates;  // collision pairs from the broad phase
+    std::vector<std::pair<unsigned, unsigned>> merges;      // touching pairs waiting to be merged
+    std::vector<uint8_t> moved;     // bodies already moved this step by the swept collision pass
+    std::vector<std::pair<unsigned, unsigned>> touching;    // contacts used to build sleep islands
+    std::vector<uint8_t> wakeIsland;    // by island id
+
+    Workspace();
+    Workspace(const Workspace&);
+    Workspace& operator=(const Workspace&);
+    ~Workspace();
+};
+
+// Plain description of a single body, used to add bodies to a World and to read one back.
+class Object{
+public:
+    float radius;
+    std::vector<float> center;
+    float massKg;
+    std::vector<float> velocity;
+    std::vector<float> color;
+    std::vector<float> acceleration;
+
+    Object(float radius, std::vector<float> center, float massKg, std::vector<float> velocity, std::vector<float> color, std::vector<float> acceleration = {0.0f, 0.0f}){
+        this->radius = radius;
+        this->center = center;
+        this->massKg = massKg;
+        this->velocity = velocity;
+        this->color = color;
+        this->acceleration = acceleration;
+    }
+};
+
+// All bodies of one simulation, stored as one array per quantity so the force and
+// collision loops walk contiguous memory.
+class World{
+public:
+    Config config;
+
+    std::vector<float> x, y;        // center
+    std::vector<float> vx, vy;      // velocity
+    std::vector<float> ax, ay;      // acceleration from the last force pass
+    std::vector<float> mass;
+    std::vector<float> radius;
+    std::vector<float> red, green, blue;
+    std::vector<uint32_t> id;       // stays with the body when the arrays are compacted
+    std::vector<uint8_t> asleep;    // skipped by integration and collisions, see SleepConfig
+    std::vector<uint32_t> stillSteps;   // steps in a row the body has been slow
+    std::vector<uint32_t> island;   // id of the island the body fell asleep in
+
+    std::vector<float> potential;   // per unit mass, only filled while computePotential is set
+    bool computePotential = false;
+
+    uint64_t stepCount = 0;
+    double time = 0.0;
+    uint32_t nextId = 0;
+    uint64_t layoutVersion = 0;     // bumped whenever bodies change index, so cached pair data can be dropped
+    std::vector<uint32_t> indexOfId;    // NO_BODY for ids that were merged away
+
+    Workspace workspace;
+
+    World() = default;
+    explicit World(const Config& config) : config(config){}
+
+    static constexpr uint32_t NO_BODY = 0xFFFFFFFF;
+
+    size_t size() const{ return x.size(); }
+    size_t indexOf(uint32_t bodyId) const{ return bodyId < indexOfId.size() ? indexOfId[bodyId] : NO_BODY; }
+    size_t addBody(const Object& object);   // returns the index of the new body
+    size_t addBody(const Object& object, uint32_t bodyId);  // with a given id, e.g. a body moving in from another rank
+    Object body(size_t i) const;
+    void clear();
+    ThreadPool& threadPool();   // sized by config.threads, rebuilt if that changes
+    // One arena per pool thread for data that only lives until the end of the step. step()
+    // and BeginStep reset them, so nothing allocated from them may be kept across steps.
+    StepArenas& arenas();
+    // Moves the part of every body array each pool thread works on to that thread's NUMA
+    // node. step() calls it when config.numa is set and the arrays moved or changed size.
+    void placeOnNodes();
+
+    // Drops every body whose keep flag is 0, moving the rest down in their original order.
+    void compact(const uint8_t* keep);
+    // Moves body order[i] to index i for every i.
+    void permute(const uint32_t* order);
+
+    // Calls f on every per-body array, for operations that have to move all of them together.
+    template<class F> void forEachArray(F&& f){
+        f(x); f(y); f(vx); f(vy); f(ax); f(ay);
+        f(mass); f(radius); f(red); f(green); f(blue); f(id);
+        f(asleep); f(stillSteps); f(island);
+    }
+};
+
+// Advances every body in the world by dt: forces, integration, collisions, then the boundary.
+void step(World& world, float dt);
+
+// Individual stages of step(), exposed so callers can build their own loop. Such a loop
+// calls BeginStep before the stages of every step, or the arenas the stages allocate
+// from are never freed and grow with every step.
+void BeginStep(World& world);
+void ComputeForces(World& world);
+void Integrate(World& world, float dt);
+void CollisionDetect(World& world);
+
+// Bounce response for one touching pair.
+void Collides(World& world, size_t a, size_t b);
+
+// Continuous collision detection, run between the velocity and position updates. Finds the
+// time each pair of paths first touches within dt, moves those bodies to the impact,
+// resolves it and moves them on for the rest of the step, flagging them in moved.
+void SweptCollisions(World& world, float dt, std::vector<uint8_t>& moved);
+
+// Builds islands from this step's contacts, puts resting grounded islands to sleep and
+// wakes sleeping islands that a moving body touches.
+void UpdateSleeping(World& world, const std::vector<std::pair<unsigned, unsigned>>& candidates);
+
+// Merges every connected group of touching pairs into one body and compacts the arrays.
+void MergeBodies(World& world, const std::vector<std::pair<unsigned, unsigned>>& pairs);
+
+}
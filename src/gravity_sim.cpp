@@ -4,8 +4,29 @@
 #include <cmath>
 #include <vector>
 #include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <string>
+#include "allocation_count.h"
+#include "density.h"
+#include "domain.h"
+#include "gravity.h"
+#include "kernel_check.h"
+#include "offscreen.h"
+#include "profiler.h"
+#include "shm_export.h"
+#include "snapshot.h"
+#include "trajectory.h"
+#include "transport.h"
+#include "viewer3d.h"
+#include "world3d.h"
+#include <atomic>
+#include <thread>
 
 using namespace std;
+using namespace gravity;
 
 float GRAVITATIONAL_CONSTANT = 0.00000001;
 float EARTH_MASS = 5.0;
@@ -21,135 +42,666 @@ float MOON_ORBIT_DISTANCE = 0.0026 * AU;  // Moon distance in screen units
 float EARTH_ORBITAL_VELOCITY = sqrt(GRAVITATIONAL_CONSTANT * SUN_MASS / AU);
 float MOON_ORBITAL_VELOCITY = sqrt(GRAVITATIONAL_CONSTANT * EARTH_MASS / MOON_ORBIT_DISTANCE);
 
+const float FIXED_STEP = 0.02f;     // headless and --deterministic runs step this much, never the frame time
 
 
-GLFWwindow* StartGLFW();
 
-class Object{
-public:
-    float radius;
-    vector<float> center;
-    float massKg;
-    vector<float> velocity;
-    vector<float> color;
-    vector<float> acceleration;
+GLFWwindow* StartGLFW();
 
+struct Options{
+    bool headless = false;  // step without opening a window
+    long steps = -1;        // stop after this many steps, -1 runs until the window closes
+    bool profile = false;   // print the per-phase frame time breakdown
+    string tracePath;       // write a Chrome trace JSON here on exit
+    string shareName;       // publish every step to this shared memory block
+    uint32_t shareSlots = SharedPublisher::DEFAULT_SLOTS;  // frames in the shared ring before the writer laps a reader
+    string attachName;      // draw another process's shared memory block instead of simulating
+    bool asyncRender = false;   // draw on a separate thread so vsync never holds up the physics
+    bool threeD = false;    // simulate and draw the scene in 3D
+    string offscreenPrefix; // headless runs write PPM frames named prefix00000.ppm, ...
+    bool countAllocations = false;  // report global heap allocations made after a warm-up
+    int ranks = 1;          // headless: split the simulation across this many processes
+    unsigned threads = 1;   // worker threads stepping the world
+    bool numa = false;      // pin the threads node by node and keep their bodies in local memory
+    string recordPath;      // append the bodies to this trajectory recording
+    long recordEvery = 1;   // steps between recorded frames
+    string replayPath;      // play this recording back instead of simulating
+    double speed = 1.0;     // replay: recorded seconds per real second
+    double seek = 0.0;      // replay: recorded time to start at
+    bool density = false;   // draw 2D frames as density images however few bodies there are
+    bool deterministic = false;     // fixed steps and thread count independent sums, see Config::deterministic
+    string hashPath;        // write the StateHash after every step here
+    bool fastRsqrt = false; // direct sums use ForceKernel::FastRsqrt
+    bool checkKernel = false;   // print the force kernels' errors and exit, nonzero if FastRsqrt is out of bounds
+};
 
-    Object(float radius, vector<float> center, float massKg, vector<float> velocity, vector<float> color, vector<float> acceleration){
-        this->radius = radius;
-        this->center = center;
-        this->massKg = massKg;
-        this->velocity = velocity;
-        this->color = color;
-        this->acceleration = acceleration;
+Options ParseOptions(int argc, char** argv){
+    Options options;
+    for(int i = 1; i < argc; i++){
+        bool hasValue = i + 1 < argc;
+        if(strcmp(argv[i], "--headless") == 0){
+            options.headless = true;
+        }
+        else if(strcmp(argv[i], "--steps") == 0 && hasValue){
+            options.steps = atol(argv[++i]);
+        }
+        else if(strcmp(argv[i], "--profile") == 0){
+            options.profile = true;
+        }
+        else if(strcmp(argv[i], "--trace") == 0 && hasValue){
+            options.tracePath = argv[++i];
+            options.profile = true;
+        }
+        else if(strcmp(argv[i], "--share") == 0 && hasValue){
+            options.shareName = argv[++i];
+        }
+        else if(strcmp(argv[i], "--share-slots") == 0 && hasValue){
+            options.shareSlots = uint32_t(max(2, atoi(argv[++i])));
+        }
+        else if(strcmp(argv[i], "--attach") == 0 && hasValue){
+            options.attachName = argv[++i];
+        }
+        else if(strcmp(argv[i], "--async-render") == 0){
+            options.asyncRender = true;
+        }
+        else if(strcmp(argv[i], "--3d") == 0){
+            options.threeD = true;
+        }
+        else if(strcmp(argv[i], "--offscreen") == 0 && hasValue){
+            options.offscreenPrefix = argv[++i];
+        }
+        else if(strcmp(argv[i], "--count-allocations") == 0){
+            options.countAllocations = true;
+        }
+        else if(strcmp(argv[i], "--ranks") == 0 && hasValue){
+            options.ranks = max(1, atoi(argv[++i]));
+        }
+        else if(strcmp(argv[i], "--threads") == 0 && hasValue){
+            options.threads = unsigned(max(1, atoi(argv[++i])));
+        }
+        else if(strcmp(argv[i], "--numa") == 0){
+            options.numa = true;
+        }
+        else if(strcmp(argv[i], "--record") == 0 && hasValue){
+            options.recordPath = argv[++i];
+        }
+        else if(strcmp(argv[i], "--record-every") == 0 && hasValue){
+            options.recordEvery = max(1L, atol(argv[++i]));
+        }
+        else if(strcmp(argv[i], "--replay") == 0 && hasValue){
+            options.replayPath = argv[++i];
+        }
+        else if(strcmp(argv[i], "--speed") == 0 && hasValue){
+            options.speed = max(1e-3, atof(argv[++i]));
+        }
+        else if(strcmp(argv[i], "--seek") == 0 && hasValue){
+            options.seek = atof(argv[++i]);
+        }
+        else if(strcmp(argv[i], "--density") == 0){
+            options.density = true;
+        }
+        else if(strcmp(argv[i], "--deterministic") == 0){
+            options.deterministic = true;
+        }
+        else if(strcmp(argv[i], "--hash") == 0 && hasValue){
+            options.hashPath = argv[++i];
+        }
+        else if(strcmp(argv[i], "--fast-rsqrt") == 0){
+            options.fastRsqrt = true;
+        }
+        else if(strcmp(argv[i], "--check-kernel") == 0){
+            options.checkKernel = true;
+        }
+        else{
+            cerr<<"unknown option "<<argv[i]<<endl;
+            cerr<<"usage: gravity_sim [--headless] [--steps N] [--profile] [--trace file.json] [--share name [--share-slots N]] [--attach name] [--async-render] [--3d] [--offscreen prefix] [--count-allocations] [--ranks N] [--threads N] [--numa] [--record file [--record-every N]] [--replay file [--speed X] [--seek T]] [--density] [--deterministic] [--hash file] [--fast-rsqrt] [--check-kernel]"<<endl;
+            exit(1);
+        }
     }
+    if(options.headless && options.steps < 0 && options.replayPath.empty()){
+        options.steps = 1000;   // a replay stops at the end of the recording instead
+    }
+    if(options.threeD && (!options.recordPath.empty() || !options.replayPath.empty())){
+        cerr<<"recordings hold 2D worlds, --record and --replay do not work with --3d"<<endl;
+        exit(1);
+    }
+    if(options.threeD && (!options.shareName.empty() || !options.attachName.empty() || options.ranks > 1 || options.numa
+        || options.asyncRender || options.density || options.countAllocations)){
+        cerr<<"--share, --attach, --ranks, --numa, --async-render, --density and --count-allocations only work with the 2D engine"<<endl;
+        exit(1);
+    }
+#ifdef __FAST_MATH__
+    if(options.deterministic){
+        cerr<<"built with -ffast-math, results can still change from one build to the next"<<endl;
+    }
+#endif
+    if(options.ranks > 1 && !options.headless){
+        cerr<<"--ranks needs --headless; watch it with --share and --attach"<<endl;
+        exit(1);
+    }
+    return options;
+}
 
-};
-
-void DrawCircle(int triangles, Object circle){
-    glColor3f(circle.color[0], circle.color[1], circle.color[2]);
+// Draws body i of bodies. Reads straight from the arrays, nothing is copied per body.
+void DrawCircle(int triangles, const DrawView& bodies, size_t i){
+    glColor3f(bodies.red[i], bodies.green[i], bodies.blue[i]);
 
+    float centerX = bodies.x[i], centerY = bodies.y[i], radius = bodies.radius[i];
     glBegin(GL_TRIANGLE_FAN);   // tells GL to make a fan of little triangles from these vertices
-    glVertex2f(circle.center[0], circle.center[1]);   // set center vertex first
+    glVertex2f(centerX, centerY);   // set center vertex first
 
-    for(int i = 0; i <= triangles; i++){    // sets the rest of the triangles around the whole circle's circumference
-        float theta = i * 2.0f * M_PI / triangles;  // divides the circle into the arc of the triangle in radians, 2pi rad / how many triangles
-        float x = circle.center[0] + circle.radius * cos(theta);    // gets the correct coordinates for the two outer vertices 
-        float y = circle.center[1] + circle.radius * sin(theta);
+    for(int k = 0; k <= triangles; k++){    // sets the rest of the triangles around the whole circle's circumference
+        float theta = k * 2.0f * M_PI / triangles;  // divides the circle into the arc of the triangle in radians, 2pi rad / how many triangles
+        float x = centerX + radius * cos(theta);    // gets the correct coordinates for the two outer vertices 
+        float y = centerY + radius * sin(theta);
         glVertex2f(x, y);       // sets the vertices
     }
 
     glEnd();
 }
 
-void Collides(Object& object1, Object& object2){
-    float distance = sqrt(pow(object1.center[0] - object2.center[0], 2) + pow(object1.center[1] - object2.center[1], 2));
-    float unitVectorx = (object2.center[0] - object1.center[0]) / distance;
-    float unitVectory = (object2.center[1] - object1.center[1]) / distance;
+void DrawBodies(const DrawView& bodies){
+    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT);
+    for(size_t i = 0; i < bodies.count; i++){
+        DrawCircle(100, bodies, i);  // range of window is [-1.0, 1.0] for floats
+    }
+}
 
-    float xvel = object1.velocity[0] - object2.velocity[0];
-    float yvel = object1.velocity[1] - object2.velocity[1];
+const size_t DENSITY_BODIES = 100000;   // past this many bodies 2D frames are drawn as density images
 
-    float vector =
-        xvel * unitVectorx +
-        yvel * unitVectory;
-    float totalInvMass = 1/object1.massKg + 1/object2.massKg;
+// Puts an image rendered in memory on the window, one image pixel per framebuffer pixel.
+void DrawImage(const Image& image){
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);  // rows of 3 byte pixels are not padded
+    glRasterPos2f(-1.0f, 1.0f);
+    glPixelZoom(1.0f, -1.0f);   // image rows run from the top
+    glDrawPixels(image.width, image.height, GL_RGB, GL_UNSIGNED_BYTE, image.rgb.data());
+}
 
-    float impulse = (-(1 + .9) * vector) / (totalInvMass);
-    float impulsex = unitVectorx * impulse;
-    float impulsey = unitVectory * impulse;
+// Draws 2D frames in the window or into memory: every body as a disc, or as a density
+// image with --density and whenever there are more than DENSITY_BODIES bodies.
+class FrameDrawer{
+public:
+    explicit FrameDrawer(const Options& options) : alwaysDensity(options.density), threads(options.threads){}
 
-    object1.velocity[0] += impulsex * (1/object1.massKg);
-    object1.velocity[1] += impulsey * (1/object1.massKg);
-    object2.velocity[0] -= impulsex * (1/object2.massKg);
-    object2.velocity[1] -= impulsey * (1/object2.massKg);
-    
-    
-    float penetration = object1.radius + object2.radius - distance;
-    if(penetration > 0){
-        float correctionPercent = 0.98f; 
-        float slop = 0.001f; 
+    void draw(GLFWwindow* window, const DrawView& bodies){
+        if(!useDensity(bodies)){
+            DrawBodies(bodies);
+            return;
+        }
+        int width, height;
+        glfwGetFramebufferSize(window, &width, &height);
+        if(width != image.width || height != image.height){
+            image.resize(width, height);
+        }
+        densityRenderer().render(bodies, image);
+        DrawImage(image);
+    }
 
-        float correction = max(penetration - slop, 0.0f) 
-            * correctionPercent;
+    void render(const DrawView& bodies, Image& target){
+        if(useDensity(bodies)){
+            densityRenderer().render(bodies, target);
+        }
+        else{
+            RenderDiscs(bodies, target);
+        }
+    }
 
-        object1.center[0] -= unitVectorx * correction * ((1/object1.massKg) / totalInvMass);
-        object1.center[1] -= unitVectory * correction * ((1/object1.massKg) / totalInvMass);
+private:
+    bool useDensity(const DrawView& bodies) const{ return alwaysDensity || bodies.count > DENSITY_BODIES; }
+    DensityRenderer& densityRenderer(){
+        if(!density){
+            density.reset(new DensityRenderer(threads));
+        }
+        return *density;
+    }
+
+    bool alwaysDensity;
+    unsigned threads;
+    unique_ptr<DensityRenderer> density;
+    Image image;
+};
 
-        object2.center[0] += unitVectorx * correction * ((1/object2.massKg) / totalInvMass);
-        object2.center[1] += unitVectory * correction * ((1/object2.massKg) / totalInvMass);
+// Owns the GL context and draws the newest snapshot until running goes false. Only this
+// thread waits on vsync.
+void RenderLoop(GLFWwindow* window, TripleBuffer& frames, const atomic<bool>& running, const Options& options){
+    glfwMakeContextCurrent(window);
+    glfwSwapInterval(1);
+    FrameDrawer drawer(options);
+    while(running.load()){
+        ScopedTimer timer(Phase::Render);
+        frames.update();
+        drawer.draw(window, ViewOf(frames.readBuffer()));
+        glfwSwapBuffers(window);
     }
+    glfwMakeContextCurrent(NULL);
+}
 
+// Viewer for a simulation running in another process with --share.
+int RunAttached(const Options& options){
+    SharedSubscriber subscriber(options.attachName);
+    if(!subscriber.ok()){
+        cerr<<"no shared simulation named "<<options.attachName<<endl;
+        return 1;
+    }
+    GLFWwindow* window = StartGLFW();
+    FrameDrawer drawer(options);
+    Profiler& profiler = Profiler::instance();
+    double lastSummary = glfwGetTime();
+    Snapshot incoming, shown;
+    bool haveFrame = false;
+    while(!glfwWindowShouldClose(window)){
+        if(subscriber.copyLatest(incoming)){    // otherwise the last complete frame stays up
+            swap(incoming, shown);
+            haveFrame = true;
+        }
+        if(haveFrame){
+            ScopedTimer timer(Phase::Render);
+            drawer.draw(window, ViewOf(shown));
+            glfwSwapBuffers(window);
+        }
+        glfwPollEvents();
+        if(options.profile){
+            profiler.endFrame();
+            if(glfwGetTime() - lastSummary > 1.0){
+                cerr<<profiler.summaryText()<<endl;
+                lastSummary = glfwGetTime();
+            }
+        }
+    }
+    return 0;
 }
 
-void CollisionDetect(Object& object, vector<Object>& objects){
-    for(int i = 0; i < objects.size(); i++){
-        float distance = sqrt(pow(object.center[0] - objects[i].center[0], 2) + pow(object.center[1] - objects[i].center[1], 2));
-        if(distance <= object.radius + objects[i].radius && distance != 0){
-            Collides(object, objects[i]);
+// Plays a recording back without simulating. Playback follows the recorded time,
+// options.speed recorded seconds per second, and shows the last frame recorded at or
+// before it, so frames are skipped whenever playback outruns them. Headless runs step
+// playback by 1/60 s per frame and write the frames to options.offscreenPrefix.
+// Space pauses, left and right seek by a twentieth of the recording, up and down
+// double and halve the speed, and Home goes back to the start.
+int RunReplay(const Options& options){
+    TrajectoryReader reader(options.replayPath);
+    if(!reader.ok()){
+        return 1;
+    }
+    FramePrefetcher prefetcher(reader);
+    double start = reader.time(0), end = reader.time(reader.frameCount() - 1);
+    double recordedStep = reader.frameCount() > 1 ? (end - start) / (reader.frameCount() - 1) : 0.0;
+    // frames playback moves per shown frame, for the prefetcher
+    auto stride = [&](double playbackStep){
+        return recordedStep > 0.0 ? size_t(max(1.0, playbackStep / recordedStep)) : size_t(1);
+    };
+    double playback = max(start, min(end, options.seek));
+    double speed = options.speed;
+    long frame = 0;
+    FrameDrawer drawer(options);
+    Profiler& profiler = Profiler::instance();
+    const int SUMMARY_EVERY = 60;   // frames between profile printouts
+
+    if(options.headless){
+        const double OUTPUT_FRAME_TIME = 1.0 / 60.0;
+        Image image;
+        image.resize(800, 600);
+        for(; frame != options.steps; frame++){
+            size_t shown = reader.frameAt(playback);
+            prefetcher.request(shown, stride(speed * OUTPUT_FRAME_TIME));
+            if(!options.offscreenPrefix.empty()){
+                ScopedTimer timer(Phase::Render);
+                drawer.render(reader.frame(shown).bodies, image);
+                char number[32];
+                snprintf(number, sizeof(number), "%05ld.ppm", frame);
+                if(!WritePpm(image, options.offscreenPrefix + number)){
+                    cerr<<"failed to write "<<options.offscreenPrefix + number<<endl;
+                    return 1;
+                }
+            }
+            if(options.profile){
+                profiler.endFrame();
+                if(frame % SUMMARY_EVERY == SUMMARY_EVERY - 1){
+                    cerr<<profiler.summaryText()<<endl;
+                }
+            }
+            if(playback >= end){
+                frame++;
+                break;
+            }
+            playback = min(end, playback + speed * OUTPUT_FRAME_TIME);
+        }
+        cerr<<"replayed "<<frame<<" frames of "<<options.replayPath<<endl;
+        return 0;
+    }
+
+    GLFWwindow* window = StartGLFW();
+    const int KEYS[] = {GLFW_KEY_SPACE, GLFW_KEY_LEFT, GLFW_KEY_RIGHT, GLFW_KEY_UP, GLFW_KEY_DOWN, GLFW_KEY_HOME};
+    bool held[6] = {};
+    auto pressed = [&](int k){     // true once per press
+        bool down = glfwGetKey(window, KEYS[k]) == GLFW_PRESS;
+        bool press = down && !held[k];
+        held[k] = down;
+        return press;
+    };
+    bool paused = false;
+    double previousFrameTime = glfwGetTime(), lastTitle = previousFrameTime, lastSummary = previousFrameTime;
+    while(!glfwWindowShouldClose(window) && frame != options.steps){
+        double currentTime = glfwGetTime();
+        double elapsed = currentTime - previousFrameTime;
+        previousFrameTime = currentTime;
+
+        if(pressed(0)){
+            paused = !paused;
+        }
+        playback += (pressed(2) - pressed(1)) * 0.05 * (end - start);
+        speed *= pressed(3) ? 2.0 : 1.0;
+        speed *= pressed(4) ? 0.5 : 1.0;
+        if(pressed(5)){
+            playback = start;
+        }
+        if(!paused){
+            playback += speed * elapsed;
+        }
+        playback = max(start, min(end, playback));
+
+        size_t shown = reader.frameAt(playback);
+        prefetcher.request(shown, stride(speed * elapsed));
+        {
+            ScopedTimer timer(Phase::Render);
+            drawer.draw(window, reader.frame(shown).bodies);
+            glfwSwapBuffers(window);
+        }
+        glfwPollEvents();
+
+        if(currentTime - lastTitle > 0.25){
+            char title[128];
+            snprintf(title, sizeof(title), "gravity_sim | replay t=%.2f/%.2f x%g%s", playback, end, speed, paused ? " paused" : "");
+            glfwSetWindowTitle(window, title);
+            lastTitle = currentTime;
+        }
+        if(options.profile){
+            profiler.endFrame();
+            if(currentTime - lastSummary > 1.0){
+                cerr<<profiler.summaryText()<<endl;
+                lastSummary = currentTime;
+            }
         }
+        frame++;
     }
-    if(object.center[1] - object.radius <= -1.0){     // bottom screen
-            object.center[1] = -1.0 + object.radius;
-            object.velocity[1] = -object.velocity[1] * 0.95;
+    return 0;
+}
+
+// Sphere impostor in view space: a disc facing the camera, its middle pulled toward the
+// camera so the depth test sees a bulge, and colors shaded like the sphere behind it.
+void DrawSphere(int triangles, const ViewPoint& center, float radius, float red, float green, float blue){
+    float shade = SphereShade(0.0f, 0.0f, -1.0f);
+    glBegin(GL_TRIANGLE_FAN);
+    glColor3f(red * shade, green * shade, blue * shade);
+    glVertex3f(center.x, center.y, -(center.depth - radius));   // GL looks down -z
+    for(int i = 0; i <= triangles; i++){
+        float theta = i * 2.0f * M_PI / triangles;
+        shade = SphereShade(cos(theta), sin(theta), 0.0f);
+        glColor3f(red * shade, green * shade, blue * shade);
+        glVertex3f(center.x + radius * cos(theta), center.y + radius * sin(theta), -center.depth);
     }
-    else if(object.center[1] + object.radius >= 1.0){ // top screen
-        object.center[1] = 1.0 - object.radius;
-        object.velocity[1] = -object.velocity[1] * 0.95;
+    glEnd();
+}
+
+void DrawWorld3D(const World3D& world, const Camera& camera, float aspect){
+    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    glEnable(GL_DEPTH_TEST);
+    glMatrixMode(GL_PROJECTION);
+    glLoadIdentity();
+    float top = camera.nearPlane / camera.focalLength();
+    glFrustum(-top * aspect, top * aspect, -top, top, camera.nearPlane, camera.farPlane);
+    glMatrixMode(GL_MODELVIEW);
+    glLoadIdentity();   // vertices are already in view space
+    for(size_t i = 0; i < world.size(); i++){
+        ViewPoint center = camera.toView(world.x[i], world.y[i], world.z[i]);
+        DrawSphere(32, center, world.radius[i], world.red[i], world.green[i], world.blue[i]);
     }
-    else if(object.center[0] + object.radius >= 1.0){ // right screen
-        object.center[0] = 1.0 - object.radius;
-        object.velocity[0] = -object.velocity[0] * 0.95;
+}
+
+// The Sun/Earth/Moon scene with the Moon's orbit tilted out of the Earth's, stepped in 3D.
+// Arrow keys turn the camera around the Sun, W and S move it closer and further.
+int Run3D(const Options& options){
+    const float MOON_INCLINATION = 5.145f * M_PI / 180.0f;
+    Config3D config;
+    config.gravitationalConstant = GRAVITATIONAL_CONSTANT;
+    config.threads = options.threads;
+    config.kernel = options.fastRsqrt ? ForceKernel::FastRsqrt : ForceKernel::Exact;
+    World3D world(config);
+    world.addBody(Object(EARTH_RADIUS, {AU, 0.0f, 0.0f}, EARTH_MASS, {0.0f, EARTH_ORBITAL_VELOCITY, 0.0f}, {0.0f, 0.5f, 1.0f}));
+    world.addBody(Object(SUN_RADIUS, {0.0f, 0.0f, 0.0f}, SUN_MASS, {0.0f, 0.0f, 0.0f}, {1.0f, 1.0f, 0.0f}));
+    world.addBody(Object(MOON_RADIUS, {AU + MOON_ORBIT_DISTANCE, 0.0f, 0.0f}, MOON_MASS,
+        {0.0f, EARTH_ORBITAL_VELOCITY + MOON_ORBITAL_VELOCITY * cos(MOON_INCLINATION), MOON_ORBITAL_VELOCITY * sin(MOON_INCLINATION)},
+        {0.7f, 0.7f, 0.7f}));
+
+    Profiler& profiler = Profiler::instance();
+    const int SUMMARY_EVERY = 60;
+    const int OFFSCREEN_EVERY = 10;     // steps between offscreen frames
+    Camera camera;
+    float yaw = 0.0f, pitch = 0.45f, distance = 2.7f;
+    camera.orbit(yaw, pitch, distance);
+    long frame = 0;
+    ofstream hashes;
+    if(!options.hashPath.empty()){
+        hashes.open(options.hashPath);
+        if(!hashes){
+            cerr<<"failed to create "<<options.hashPath<<endl;
+            return 1;
+        }
     }
-    else if(object.center[0] - object.radius <= -1.0){ // left screen
-        object.center[0] = -1.0 + object.radius;
-        object.velocity[0] = -object.velocity[0] * 0.95;
+    auto stepWorld = [&](float dt){
+        step(world, dt);
+        if(hashes.is_open()){
+            hashes<<world.stepCount<<' '<<hex<<StateHash(world)<<dec<<'\n';
+        }
+    };
+    auto finish = [&]{
+        if(options.deterministic){
+            cerr<<"state hash after "<<world.stepCount<<" steps: "<<hex<<StateHash(world)<<dec<<endl;
+        }
+        return 0;
+    };
+
+    if(options.headless){
+        Image image;
+        image.resize(800, 600);
+        for(; frame < options.steps; frame++){
+            stepWorld(FIXED_STEP);
+            if(!options.offscreenPrefix.empty() && frame % OFFSCREEN_EVERY == 0){
+                ScopedTimer timer(Phase::Render);
+                RenderSpheres(world, camera, image);
+                char number[32];
+                snprintf(number, sizeof(number), "%05ld.ppm", frame / OFFSCREEN_EVERY);
+                if(!WritePpm(image, options.offscreenPrefix + number)){
+                    cerr<<"failed to write "<<options.offscreenPrefix + number<<endl;
+                    return 1;
+                }
+            }
+            if(options.profile){
+                profiler.endFrame();
+                if(frame % SUMMARY_EVERY == SUMMARY_EVERY - 1){
+                    cerr<<profiler.summaryText()<<endl;
+                }
+            }
+        }
+        return finish();
     }
-    else{
-        return;
+
+    GLFWwindow* window = StartGLFW();
+    double previousFrameTime = glfwGetTime();
+    while(!glfwWindowShouldClose(window) && frame != options.steps){
+        double currentTime = glfwGetTime();
+        float timeDiff = float(min(currentTime - previousFrameTime, 0.02));
+        previousFrameTime = currentTime;
+
+        yaw += (glfwGetKey(window, GLFW_KEY_RIGHT) - glfwGetKey(window, GLFW_KEY_LEFT)) * timeDiff;
+        pitch += (glfwGetKey(window, GLFW_KEY_UP) - glfwGetKey(window, GLFW_KEY_DOWN)) * timeDiff;
+        pitch = max(-1.5f, min(1.5f, pitch));
+        distance *= 1.0f + (glfwGetKey(window, GLFW_KEY_S) - glfwGetKey(window, GLFW_KEY_W)) * timeDiff;
+        camera.orbit(yaw, pitch, distance);
+
+        {
+            ScopedTimer timer(Phase::Render);
+            DrawWorld3D(world, camera, 800.0f / 600.0f);    // the size StartGLFW opens
+        }
+        stepWorld(options.deterministic ? FIXED_STEP : timeDiff);
+        {
+            ScopedTimer timer(Phase::Render);
+            glfwSwapBuffers(window);
+        }
+        glfwPollEvents();
+
+        if(options.profile){
+            profiler.endFrame();
+            if(frame % SUMMARY_EVERY == SUMMARY_EVERY - 1){
+                string summary = profiler.summaryText();
+                glfwSetWindowTitle(window, ("gravity_sim | " + summary).c_str());
+                cerr<<summary<<endl;
+            }
+        }
+        frame++;
     }
+    return finish();
 }
 
-void NearGravity(Object& circle, vector<Object> circles){
-    for(int i = 0; i < circles.size(); i++){
-        if(circle.center[0] == circles[i].center[0] && circle.center[1] == circles[i].center[1]){ //same circle
-            continue;
+// Headless run split across options.ranks processes. Rank 0 gathers the bodies whenever
+// something needs all of them: sharing, recording, hashing, offscreen frames and the final
+// --deterministic hash. Every rank counts its own allocations; the --trace file holds
+// rank 0's phases.
+int RunDecomposed(const Options& options, const World& world){
+    ofstream hashes;
+    if(!options.hashPath.empty()){
+        hashes.open(options.hashPath);  // before the fork, so a bad path stops every rank
+        if(!hashes){
+            cerr<<"failed to create "<<options.hashPath<<endl;
+            return 1;
+        }
+    }
+    unique_ptr<Transport> transport = SocketTransport::Fork(options.ranks);
+    if(!transport){
+        return 1;
+    }
+    Domain domain(*transport, world);
+    if(!domain.ok()){
+        return 1;
+    }
+    bool root = transport->rank() == 0;
+    if(!root){
+        hashes.close();
+    }
+    unique_ptr<SharedPublisher> publisher;
+    if(root && !options.shareName.empty()){
+        publisher.reset(new SharedPublisher(options.shareName, uint32_t(world.size()), options.shareSlots));
+    }
+    unique_ptr<TrajectoryWriter> recorder;
+    if(root && !options.recordPath.empty()){
+        recorder.reset(new TrajectoryWriter(options.recordPath));
+    }
+    FrameDrawer drawer(options);
+    Image image;
+    if(root && !options.offscreenPrefix.empty()){
+        image.resize(800, 600);
+    }
+    Profiler& profiler = Profiler::instance();
+    const int SUMMARY_EVERY = 60;
+    const int OFFSCREEN_EVERY = 10;
+    const long WARM_UP = 10;
+    World gathered;
+    long frame = 0;
+    for(; frame < options.steps; frame++){
+        if(options.countAllocations && frame == WARM_UP){
+            EnableAllocationCounting();
+        }
+        if(!domain.step(FIXED_STEP)){
+            return 1;
+        }
+        // the same on every rank, so all of them take part in the gather
+        bool record = !options.recordPath.empty() && frame % options.recordEvery == 0;
+        bool offscreen = !options.offscreenPrefix.empty() && frame % OFFSCREEN_EVERY == 0;
+        if(!options.shareName.empty() || record || !options.hashPath.empty() || offscreen){
+            ScopedTimer timer(Phase::IO);
+            if(!domain.gather(gathered)){
+                return 1;
+            }
+            if(publisher){
+                publisher->publish(gathered);
+            }
+            if(recorder && record){
+                recorder->write(gathered);
+            }
+            if(hashes.is_open()){
+                hashes<<gathered.stepCount<<' '<<hex<<StateHash(gathered)<<dec<<'\n';
+            }
+        }
+        if(root && offscreen){
+            ScopedTimer timer(Phase::Render);
+            drawer.render(ViewOf(gathered), image);
+            char number[32];
+            snprintf(number, sizeof(number), "%05ld.ppm", frame / OFFSCREEN_EVERY);
+            if(!WritePpm(image, options.offscreenPrefix + number)){
+                cerr<<"failed to write "<<options.offscreenPrefix + number<<endl;
+                return 1;
+            }
+        }
+        if(options.profile){
+            profiler.endFrame();
+            if(frame % SUMMARY_EVERY == SUMMARY_EVERY - 1){
+                cerr<<"rank "<<transport->rank()<<": "<<profiler.summaryText()<<endl;
+            }
         }
-        float distance = sqrt(pow(circle.center[0] - circles[i].center[0], 2) + pow(circle.center[1] - circles[i].center[1], 2));
-        float distanceMeter = distance;
-        float unitVectorx = (circles[i].center[0] - circle.center[0]) / distance;
-        float unitVectory = (circles[i].center[1] - circle.center[1]) / distance;
-        float gForce = (GRAVITATIONAL_CONSTANT * circle.massKg * circles[i].massKg) / (pow(distanceMeter, 2));
-        float forceX = gForce * unitVectorx;
-        float forceY = gForce * unitVectory;
-        circle.acceleration[0] += forceX/circle.massKg;
-        circle.acceleration[1] += forceY/circle.massKg;
+    }
+    if(options.countAllocations){
+        EnableAllocationCounting(false);
+        cerr<<"rank "<<transport->rank()<<": "<<GlobalAllocations()<<" global allocations in "
+            <<max(0L, frame - WARM_UP)<<" frames after warm-up"<<endl;
+    }
+    if(options.deterministic){
+        if(!domain.gather(gathered)){
+            return 1;
+        }
+        if(root){
+            cerr<<"state hash after "<<gathered.stepCount<<" steps: "<<hex<<StateHash(gathered)<<dec<<endl;
+        }
+    }
+    if(root && !options.tracePath.empty() && !profiler.writeChromeTrace(options.tracePath)){
+        cerr<<"failed to write trace "<<options.tracePath<<endl;
+    }
+    cerr<<"rank "<<transport->rank()<<" finished with "<<domain.local().size()<<" bodies"<<endl;
+    return 0;
+}
 
+// Both force kernels against double precision; fails if FastRsqrt is outside its tolerance.
+int CheckKernel(){
+    KernelError exact = ForceKernelError(ForceKernel::Exact);
+    KernelError fast = ForceKernelError(ForceKernel::FastRsqrt);
+    cout<<"exact       pull "<<exact.pull<<" potential "<<exact.potential<<endl;
+    cout<<"fast rsqrt  pull "<<fast.pull<<" potential "<<fast.potential
+        <<" ("<<RSQRT_NEWTON_STEPS<<" Newton step"<<(RSQRT_NEWTON_STEPS == 1 ? "" : "s")<<", tolerance "<<FAST_RSQRT_TOLERANCE<<")"<<endl;
+    if(fast.pull > FAST_RSQRT_TOLERANCE || fast.potential > FAST_RSQRT_TOLERANCE){
+        cerr<<"fast rsqrt kernel is outside its tolerance"<<endl;
+        return 1;
     }
+    return 0;
 }
 
-int main(){
-    
+int main(int argc, char** argv){
+    Options options = ParseOptions(argc, argv);
+    if(options.checkKernel){
+        return CheckKernel();
+    }
+    Profiler& profiler = Profiler::instance();
+    if(options.profile){
+        profiler.enable(!options.tracePath.empty());
+    }
+    if(!options.attachName.empty() || !options.replayPath.empty() || options.threeD){
+        int status = !options.attachName.empty() ? RunAttached(options)
+            : !options.replayPath.empty() ? RunReplay(options) : Run3D(options);
+        if(!options.tracePath.empty() && !profiler.writeChromeTrace(options.tracePath)){
+            cerr<<"failed to write trace "<<options.tracePath<<endl;
+        }
+        return status;
+    }
+
     Object circle1(
         EARTH_RADIUS,       
     {AU, 0.0f},
@@ -174,50 +726,209 @@ int main(){
     {0.7f, 0.7f, 0.7f},
     {0.0, 0.0});
 
-    vector<Object> circles = {circle1, circle2, circle3};
+    Config config;
+    config.gravitationalConstant = GRAVITATIONAL_CONSTANT;
+    config.threads = options.threads;
+    config.numa = options.numa;
+    config.deterministic = options.deterministic;
+    config.kernel = options.fastRsqrt ? ForceKernel::FastRsqrt : ForceKernel::Exact;
+    World world(config);
+    for(const Object& circle : {circle1, circle2, circle3}){
+        world.addBody(circle);
+    }
     
     
-    float previousFrameTime = glfwGetTime();
-    GLFWwindow* window = StartGLFW();   // starts the window up
-    while(!glfwWindowShouldClose(window)){  // main GLFW loop for frames
-        
-        float currentTime = glfwGetTime();
-        float timeDiff = currentTime - previousFrameTime;
-        if (timeDiff > 0.02 ){
-            timeDiff = 0.02;
+    if(options.ranks > 1){
+        return RunDecomposed(options, world);
+    }
+
+    const int SUMMARY_EVERY = 60;   // frames between profile printouts
+    long frame = 0;
+    const long WARM_UP = 10;    // frames for the arenas and workspace buffers to reach their size
+
+    unique_ptr<SharedPublisher> publisher;
+    if(!options.shareName.empty()){
+        publisher.reset(new SharedPublisher(options.shareName, uint32_t(world.size()), options.shareSlots));
+    }
+    unique_ptr<TrajectoryWriter> recorder;
+    if(!options.recordPath.empty()){
+        recorder.reset(new TrajectoryWriter(options.recordPath));
+        if(!recorder->ok()){
+            return 1;
         }
-        previousFrameTime = currentTime;
-        
-        glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
-        glClear(GL_COLOR_BUFFER_BIT);
-
-        for(int i = 0; i < circles.size(); i++){
-            circles[i].acceleration[0] = 0.0f;
-            circles[i].acceleration[1] = 0.0f;
-        }
-
-        for(int i = 0; i < circles.size(); i++){    // velocity and position change loop for all circles
-            DrawCircle(100, circles[i]);  // draws a circle with specified radius, center, range of window is [-1.0, 1.0] for floats
-            NearGravity(circles[i], circles);
-            circles[i].velocity[1] += circles[i].acceleration[1] * timeDiff;
-            circles[i].velocity[0] += circles[i].acceleration[0] * timeDiff;
-            circles[i].center[1] += ((circles[i].velocity[1]) * timeDiff);
-            circles[i].center[0] += ((circles[i].velocity[0]) * timeDiff);
-            
+    }
+    ofstream hashes;
+    if(!options.hashPath.empty()){
+        hashes.open(options.hashPath);
+        if(!hashes){
+            cerr<<"failed to create "<<options.hashPath<<endl;
+            return 1;
         }
-
-        
-        
-        
-        
-        
-        for (int i = 0; i < circles.size(); i++){   // collision detection loop for all circles
-            CollisionDetect(circles[i], circles);
+    }
+    FrameDrawer drawer(options);
+
+    if(options.headless){
+        const int OFFSCREEN_EVERY = 10;     // steps between offscreen frames
+        Image image;
+        image.resize(800, 600);
+        for(; frame < options.steps; frame++){
+            if(options.countAllocations && frame == WARM_UP){
+                EnableAllocationCounting();
+            }
+            step(world, FIXED_STEP);    // the largest step the windowed loop would take
+            if(publisher){
+                ScopedTimer timer(Phase::IO);
+                publisher->publish(world);
+            }
+            if(recorder && frame % options.recordEvery == 0){
+                ScopedTimer timer(Phase::IO);
+                recorder->write(world);
+            }
+            if(hashes.is_open()){
+                hashes<<world.stepCount<<' '<<hex<<StateHash(world)<<dec<<'\n';
+            }
+            if(!options.offscreenPrefix.empty() && frame % OFFSCREEN_EVERY == 0){
+                ScopedTimer timer(Phase::Render);
+                drawer.render(ViewOf(world), image);
+                char number[32];
+                snprintf(number, sizeof(number), "%05ld.ppm", frame / OFFSCREEN_EVERY);
+                if(!WritePpm(image, options.offscreenPrefix + number)){
+                    cerr<<"failed to write "<<options.offscreenPrefix + number<<endl;
+                    return 1;
+                }
+            }
+            if(options.profile){
+                profiler.endFrame();
+                if(frame % SUMMARY_EVERY == SUMMARY_EVERY - 1){
+                    cerr<<profiler.summaryText()<<endl;
+                }
+            }
         }
+    }
+    else if(options.asyncRender){
+        GLFWwindow* window = StartGLFW();
+        glfwMakeContextCurrent(NULL);   // handed to the render thread
+        TripleBuffer frames;
+        Capture(world, frames.writeBuffer());
+        frames.publish();
+        atomic<bool> running(true);
+        thread renderer(RenderLoop, window, ref(frames), cref(running), cref(options));
+
+        double previousFrameTime = glfwGetTime(), startTime = previousFrameTime;
+        double lastPoll = previousFrameTime, lastSummary = previousFrameTime;
+        while(!glfwWindowShouldClose(window) && frame != options.steps){
+            if(options.countAllocations && frame == WARM_UP){
+                EnableAllocationCounting();     // counts the render thread too
+            }
+            double currentTime = glfwGetTime();
+            float timeDiff = float(min(currentTime - previousFrameTime, 0.02));
+            previousFrameTime = currentTime;
+            if(options.deterministic){
+                // fixed steps, held back to real time since nothing else paces this loop
+                double due = startTime + frame * FIXED_STEP;
+                if(currentTime < due){
+                    this_thread::sleep_for(chrono::duration<double>(due - currentTime));
+                }
+                timeDiff = FIXED_STEP;
+            }
+
+            step(world, timeDiff);
+            {
+                ScopedTimer timer(Phase::IO);
+                if(publisher){
+                    publisher->publish(world);
+                }
+                if(recorder && frame % options.recordEvery == 0){
+                    recorder->write(world);
+                }
+                if(hashes.is_open()){
+                    hashes<<world.stepCount<<' '<<hex<<StateHash(world)<<dec<<'\n';
+                }
+                Capture(world, frames.writeBuffer());
+                frames.publish();
+            }
+
+            if(currentTime - lastPoll > 0.005){     // events have to be handled on this thread, but not every step
+                glfwPollEvents();
+                lastPoll = currentTime;
+            }
+            if(options.profile){
+                profiler.endFrame();
+                if(currentTime - lastSummary > 1.0){
+                    string summary = profiler.summaryText();
+                    glfwSetWindowTitle(window, ("gravity_sim | " + summary).c_str());
+                    cerr<<summary<<endl;
+                    lastSummary = currentTime;
+                }
+            }
+            frame++;
+        }
+        running.store(false);
+        renderer.join();
+    }
+    else{
+        float previousFrameTime = glfwGetTime();
+        GLFWwindow* window = StartGLFW();   // starts the window up
+        while(!glfwWindowShouldClose(window) && frame != options.steps){  // main GLFW loop for frames
+            if(options.countAllocations && frame == WARM_UP){
+                EnableAllocationCounting();
+            }
+            
+            float currentTime = glfwGetTime();
+            float timeDiff = currentTime - previousFrameTime;
+            if (timeDiff > 0.02 ){
+                timeDiff = 0.02;
+            }
+            previousFrameTime = currentTime;
+            if(options.deterministic){
+                timeDiff = FIXED_STEP;  // one step per frame, as fast as vsync allows
+            }
+            
+            {
+                ScopedTimer timer(Phase::Render);
+                drawer.draw(window, ViewOf(world));
+            }
+
+            step(world, timeDiff);     // gravity, movement and collisions for all circles
+            if(publisher){
+                ScopedTimer timer(Phase::IO);
+                publisher->publish(world);
+            }
+            if(recorder && frame % options.recordEvery == 0){
+                ScopedTimer timer(Phase::IO);
+                recorder->write(world);
+            }
+            if(hashes.is_open()){
+                hashes<<world.stepCount<<' '<<hex<<StateHash(world)<<dec<<'\n';
+            }
+
+            {
+                ScopedTimer timer(Phase::Render);   // includes waiting for vsync
+                glfwSwapBuffers(window);
+            }
+            glfwPollEvents();
+
+            if(options.profile){
+                profiler.endFrame();
+                if(frame % SUMMARY_EVERY == SUMMARY_EVERY - 1){
+                    string summary = profiler.summaryText();
+                    glfwSetWindowTitle(window, ("gravity_sim | " + summary).c_str());
+                    cerr<<summary<<endl;
+                }
+            }
+            frame++;
+        }
+    }
 
-        glfwSwapBuffers(window);
-        glfwPollEvents();
-        
+    if(options.deterministic){
+        cerr<<"state hash after "<<world.stepCount<<" steps: "<<hex<<StateHash(world)<<dec<<endl;
+    }
+    if(options.countAllocations){
+        EnableAllocationCounting(false);
+        cerr<<GlobalAllocations()<<" global allocations in "<<max(0L, frame - WARM_UP)<<" frames after warm-up"<<endl;
+    }
+    if(!options.tracePath.empty() && !profiler.writeChromeTrace(options.tracePath)){
+        cerr<<"failed to write trace "<<options.tracePath<<endl;
     }
 }
 
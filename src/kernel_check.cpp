@@ -0,0 +1,46 @@
+#include "kernel_check.h"
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+using namespace std;
+
+namespace gravity{
+
+static const double PI = 3.14159265358979323846;
+
+template<ForceKernel K>
+static KernelError MeasureKernel(size_t pairs){
+    mt19937 random(12345);
+    uniform_real_distribution<double> decade(-3.0, 3.0), angle(0.0, 2.0 * PI);
+    KernelError worst;
+    for(size_t p = 0; p < pairs; p++){
+        double distance = pow(10.0, decade(random)), direction = angle(random);
+        float x[2] = {0.0f, float(distance * cos(direction))};
+        float y[2] = {0.0f, float(distance * sin(direction))};
+        float mass[2] = {1.0f, float(pow(10.0, decade(random)))};
+        Vec<2> acceleration = {0.0f, 0.0f};
+        float potential = 0.0f;
+        DirectAcceleration<2, K>(0, 2, {x, y}, mass, 1.0f, NoImage(), acceleration, &potential);
+
+        // the exact answer for the displacement as it was rounded to float
+        double dx = x[1], dy = y[1], r = sqrt(dx * dx + dy * dy);
+        double pull = mass[1] / (r * r * r);
+        double errorX = acceleration[0] - dx * pull, errorY = acceleration[1] - dy * pull;
+        worst.pull = max(worst.pull, sqrt(errorX * errorX + errorY * errorY) / (pull * r));
+        worst.potential = max(worst.potential, fabs(potential + mass[1] / r) * r / mass[1]);
+    }
+    return worst;
+}
+
+KernelError ForceKernelError(ForceKernel kernel, size_t pairs){
+    switch(kernel){
+    case ForceKernel::FastRsqrt:
+        return MeasureKernel<ForceKernel::FastRsqrt>(pairs);
+    case ForceKernel::Exact:
+        break;
+    }
+    return MeasureKernel<ForceKernel::Exact>(pairs);
+}
+
+}
@@ -0,0 +1,17 @@
+#pragma once
+#include <cstddef>
+#include "kernels.h"
+
+namespace gravity{
+
+// Largest relative error of the pull and the potential kernel gives for single pairs,
+// against the same formula in double precision. The pairs span six decades of distance
+// and mass in every direction and are the same on every call. ForceKernel::FastRsqrt
+// should stay under FAST_RSQRT_TOLERANCE; gravity_sim --check-kernel reports both.
+struct KernelError{
+    double pull = 0.0;
+    double potential = 0.0;
+};
+KernelError ForceKernelError(ForceKernel kernel, size_t pairs = 100000);
+
+}
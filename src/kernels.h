@@ -0,0 +1,281 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+
+#if defined(__SSE__) || defined(_M_X64) || defined(_M_AMD64)
+#include <xmmintrin.h>
+#define GRAVITY_HARDWARE_RSQRT
+#endif
+
+// Force, integration and collision kernels templated on the number of dimensions, and
+// for the ensemble also on the number of bodies. Both are compile-time constants, so
+// the per-axis loops unroll, small vectors stay in registers and there is no runtime
+// dimension branch in any inner loop. World and World3D step with the same kernels.
+namespace gravity{
+
+template<int D> using Vec = std::array<float, D>;
+
+// One array per axis: the structure-of-arrays form of a Vec<D> per body.
+template<int D> using AxisArrays = std::array<float*, D>;
+template<int D> using ConstAxisArrays = std::array<const float*, D>;
+
+template<int D> inline float Dot(const Vec<D>& a, const Vec<D>& b){
+    float sum = 0.0f;
+    for(int k = 0; k < D; k++){
+        sum += a[k] * b[k];
+    }
+    return sum;
+}
+
+template<int D> inline Vec<D> Load(const ConstAxisArrays<D>& arrays, size_t i){
+    Vec<D> v;
+    for(int k = 0; k < D; k++){
+        v[k] = arrays[k][i];
+    }
+    return v;
+}
+
+// How the direct sum turns a displacement into a pull.
+enum class ForceKernel{
+    Exact,      // sqrt and divisions
+    FastRsqrt,  // one reciprocal square root estimate refined by Newton steps and multiplies, see FastRsqrt
+};
+
+// Newton steps after the estimate. rsqrtss is good to about 12 bits and one step takes
+// it to about 22; the integer trick used without SSE is off by up to 3.4% and needs three.
+#ifdef GRAVITY_HARDWARE_RSQRT
+constexpr int RSQRT_NEWTON_STEPS = 1;
+#else
+constexpr int RSQRT_NEWTON_STEPS = 3;
+#endif
+
+// Largest relative error of a ForceKernel::FastRsqrt pull or potential against the
+// exact one that ForceKernelError (kernel_check.h) accepts. The pull goes with the cube
+// of the estimate, so it carries three times its error.
+constexpr float FAST_RSQRT_TOLERANCE = 1e-5f;
+
+inline float IntegerRsqrtEstimate(float x){
+    uint32_t bits;
+    std::memcpy(&bits, &x, sizeof(bits));
+    bits = 0x5f3759df - (bits >> 1);
+    float estimate;
+    std::memcpy(&estimate, &bits, sizeof(estimate));
+    return estimate;
+}
+
+inline float RsqrtEstimate(float x){
+#ifdef GRAVITY_HARDWARE_RSQRT
+    return _mm_cvtss_f32(_mm_rsqrt_ss(_mm_set_ss(x)));
+#else
+    return IntegerRsqrtEstimate(x);
+#endif
+}
+
+// 1 / sqrt(x) without a division or a sqrt. The estimate instruction is not specified
+// bit for bit, so results, and StateHash, can differ between CPU vendors.
+inline float FastRsqrt(float x){
+    float y = RsqrtEstimate(x);
+    for(int s = 0; s < RSQRT_NEWTON_STEPS; s++){
+        y = y * (1.5f - 0.5f * x * y * y);
+    }
+    return y;
+}
+
+// 1 / sqrt(x) for loops that should vectorize. sqrtf may set errno, so each call keeps
+// a scalar error branch, and rsqrtss is scalar only; the integer estimate works on every
+// lane, and three Newton steps take it to float precision on every CPU.
+inline float LaneRsqrt(float x){
+    float y = IntegerRsqrtEstimate(x);
+    y = y * (1.5f - 0.5f * x * y * y);     // written out: -O2 does not unroll a loop
+    y = y * (1.5f - 0.5f * x * y * y);     // here, and any loop left inside the lane
+    y = y * (1.5f - 0.5f * x * y * y);     // loop stops it vectorizing
+    return y;
+}
+
+// Displacement hook for the direct sum that leaves vectors alone, for open boundaries.
+struct NoImage{
+    template<class V> void operator()(V&) const{}
+};
+
+// Pull of every other body on body i, the NearGravity sum. image(d) may shorten a
+// displacement, e.g. to the nearest periodic copy. Adds to acceleration and, if given,
+// to the potential per unit mass. A body sitting exactly on body i has no direction to
+// pull in and is skipped, as the original NearGravity did.
+template<int D, ForceKernel K = ForceKernel::Exact, class Image>
+inline void DirectAcceleration(size_t i, size_t n, const ConstAxisArrays<D>& position, const float* mass, float G,
+    const Image& image, Vec<D>& acceleration, float* potential){
+    Vec<D> here = Load<D>(position, i);
+    for(size_t j = 0; j < n; j++){
+        Vec<D> d;
+        for(int k = 0; k < D; k++){
+            d[k] = position[k][j] - here[k];
+        }
+        image(d);
+        float distanceSquared = Dot<D>(d, d);
+        if(distanceSquared == 0.0f){   // same body, or one on top of it
+            continue;
+        }
+        if constexpr(K == ForceKernel::FastRsqrt){
+            float inverse = FastRsqrt(distanceSquared);
+            float pull = G * mass[j] * inverse;
+            if(potential){
+                *potential -= pull;
+            }
+            float scale = pull * inverse * inverse;
+            for(int k = 0; k < D; k++){
+                acceleration[k] += d[k] * scale;
+            }
+        }
+        else{
+            float distance = sqrt(distanceSquared);
+            float gForce = (G * mass[i] * mass[j]) / (pow(distance, 2));
+            if(potential){
+                *potential -= G * mass[j] / distance;
+            }
+            for(int k = 0; k < D; k++){
+                acceleration[k] += gForce * (d[k] / distance) / mass[i];
+            }
+        }
+    }
+}
+
+// Semi-implicit Euler for bodies [0, n): velocity from acceleration, then position from
+// the new velocity. Bodies for which skip(i) is true do not move.
+template<int D, class Skip>
+inline void KickDrift(const AxisArrays<D>& position, const AxisArrays<D>& velocity, const ConstAxisArrays<D>& acceleration,
+    size_t n, float dt, const Skip& skip){
+    for(size_t i = 0; i < n; i++){
+        if(skip(i)){
+            continue;
+        }
+        for(int k = 0; k < D; k++){
+            velocity[k][i] += acceleration[k][i] * dt;
+        }
+        for(int k = 0; k < D; k++){
+            position[k][i] += velocity[k][i] * dt;
+        }
+    }
+}
+
+// Bounce of two touching spheres a and b: an impulse along the line between them with
+// the given restitution, then a push apart that removes most of the overlap, shared by
+// inverse mass. d points from a to b, already shortened to the nearest image where the
+// boundary calls for it, and is not zero.
+template<int D>
+inline void BounceBodies(const AxisArrays<D>& position, const AxisArrays<D>& velocity, const float* mass, const float* radius,
+    size_t a, size_t b, const Vec<D>& d, float restitution){
+    float distance = sqrt(Dot<D>(d, d));
+    Vec<D> unit, relative;
+    for(int k = 0; k < D; k++){
+        unit[k] = d[k] / distance;
+        relative[k] = velocity[k][a] - velocity[k][b];
+    }
+    float vector = Dot<D>(relative, unit);
+    float totalInvMass = 1/mass[a] + 1/mass[b];
+
+    float impulse = (-(1 + restitution) * vector) / (totalInvMass);
+    for(int k = 0; k < D; k++){
+        float push = unit[k] * impulse;
+        velocity[k][a] += push * (1/mass[a]);
+        velocity[k][b] -= push * (1/mass[b]);
+    }
+
+    float penetration = radius[a] + radius[b] - distance;
+    if(penetration > 0){
+        float correctionPercent = 0.98f;
+        float slop = 0.001f;
+        float correction = std::max(penetration - slop, 0.0f) * correctionPercent;
+        for(int k = 0; k < D; k++){
+            position[k][a] -= unit[k] * correction * ((1/mass[a]) / totalInvMass);
+            position[k][b] += unit[k] * correction * ((1/mass[b]) / totalInvMass);
+        }
+    }
+}
+
+// One step of every system lane in [begin, end) of an ensemble. Arrays are laid out
+// [body][system], `systems` apart per body. With N > 0 the body count is that constant
+// and every body loop unrolls; N = 0 takes the count from `bodies`.
+template<int D, int N>
+void StepLanes(const AxisArrays<D>& position, const AxisArrays<D>& velocity, const AxisArrays<D>& acceleration,
+    const float* mass, size_t bodies, size_t systems, size_t begin, size_t end, float G, float dt){
+    const size_t n = N > 0 ? size_t(N) : bodies;
+    for(size_t i = 0; i < n; i++){
+        for(int k = 0; k < D; k++){
+            float* a = acceleration[k] + i * systems;
+            for(size_t s = begin; s < end; s++){
+                a[s] = 0.0f;
+            }
+        }
+        for(size_t j = 0; j < n; j++){
+            if(j == i){
+                continue;
+            }
+            const float* mj = mass + j * systems;
+            // row pointers up front so the lane loop only indexes floats; lanes never
+            // touch each other's elements, which ivdep tells GCC instead of its runtime
+            // alias checks (more than it is willing to emit here)
+            const float* pi[D];
+            const float* pj[D];
+            float* ai[D];
+            for(int k = 0; k < D; k++){
+                pi[k] = position[k] + i * systems;
+                pj[k] = position[k] + j * systems;
+                ai[k] = acceleration[k] + i * systems;
+            }
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC ivdep
+#endif
+            for(size_t s = begin; s < end; s++){    // one SIMD lane per system
+                Vec<D> d;
+                for(int k = 0; k < D; k++){
+                    d[k] = pj[k][s] - pi[k][s];
+                }
+                // no branch: bodies on top of each other take the root of 1 instead of 0
+                // and have their pull multiplied by 0
+                float distanceSquared = Dot<D>(d, d);
+                float together = float(distanceSquared == 0.0f);
+                float inverse = LaneRsqrt(distanceSquared + together);
+                float scale = G * mj[s] * inverse * inverse * inverse * (1.0f - together);
+                for(int k = 0; k < D; k++){
+                    ai[k][s] += d[k] * scale;
+                }
+            }
+        }
+    }
+    for(size_t i = 0; i < n; i++){
+        for(int k = 0; k < D; k++){
+            float* p = position[k] + i * systems;
+            float* v = velocity[k] + i * systems;
+            const float* a = acceleration[k] + i * systems;
+            for(size_t s = begin; s < end; s++){
+                v[s] += a[s] * dt;
+                p[s] += v[s] * dt;
+            }
+        }
+    }
+}
+
+constexpr int MAX_UNROLLED_BODIES = 16;
+
+template<int D> using LaneStepper = void(*)(const AxisArrays<D>&, const AxisArrays<D>&, const AxisArrays<D>&,
+    const float*, size_t, size_t, size_t, size_t, float, float);
+
+template<int D, size_t... Ns>
+constexpr std::array<LaneStepper<D>, sizeof...(Ns)> MakeLaneSteppers(std::index_sequence<Ns...>){
+    return {{&StepLanes<D, int(Ns)>...}};
+}
+
+// StepLanes specialized for the body count when it is at most MAX_UNROLLED_BODIES,
+// the general version otherwise.
+template<int D> inline LaneStepper<D> SelectLaneStepper(size_t bodies){
+    static const std::array<LaneStepper<D>, MAX_UNROLLED_BODIES + 1> steppers =
+        MakeLaneSteppers<D>(std::make_index_sequence<MAX_UNROLLED_BODIES + 1>());
+    return steppers[bodies <= size_t(MAX_UNROLLED_BODIES) ? bodies : 0];    // index 0 is the general one
+}
+
+}
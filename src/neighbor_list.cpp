@@ -0,0 +1,171 @@
+#include "neighbor_list.h"
+#include "gravity.h"
+#include "parallel.h"
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+
+namespace gravity{
+
+bool NeighborList::update(World& world, float range, bool withRadii, float skin){
+    if(covers(world, range, withRadii)){
+        return false;
+    }
+    build(world, range, withRadii, skin);
+    return true;
+}
+
+bool NeighborList::covers(const World& world, float range, bool withRadii) const{
+    if(world.layoutVersion != builtFor || world.size() != builtX.size() || withRadii != builtWithRadii){
+        return false;
+    }
+    // what is left of the skin for the two bodies of a pair to close between them
+    float margin = 0.5f * (builtSkin - max(0.0f, range - builtRange));
+    if(margin <= 0.0f){
+        return false;
+    }
+    const Boundary& boundary = world.config.boundary;
+    float marginSquared = margin * margin;
+    for(size_t i = 0; i < world.size(); i++){
+        float dx = world.x[i] - builtX[i];
+        float dy = world.y[i] - builtY[i];
+        boundary.minimumImage(dx, dy);  // wrapping around a periodic box is no movement
+        if(dx * dx + dy * dy >= marginSquared){
+            return false;
+        }
+    }
+    return true;
+}
+
+void NeighborList::build(World& world, float range, bool withRadii, float skin){
+    const Boundary& boundary = world.config.boundary;
+    size_t n = world.size();
+    builtX.assign(world.x.begin(), world.x.end());
+    builtY.assign(world.y.begin(), world.y.end());
+    builtFor = world.layoutVersion;
+    builtRange = range;
+    builtSkin = skin;
+    builtWithRadii = withRadii;
+    buildCount++;
+    pairList.clear();
+    neighborStart.assign(n + 1, 0);
+    neighbors.clear();
+    if(n == 0){
+        return;
+    }
+
+    // cells at least as wide as the furthest a listed pair can be apart
+    float largestRadius = withRadii ? *max_element(world.radius.begin(), world.radius.end()) : 0.0f;
+    float reach = max(range + skin + 2.0f * largestRadius, 1e-6f);
+    bool periodic = boundary.kind == BoundaryKind::Periodic;
+    float originX, originY, extentX, extentY;
+    if(periodic){
+        originX = boundary.minX;
+        originY = boundary.minY;
+        extentX = boundary.maxX - boundary.minX;
+        extentY = boundary.maxY - boundary.minY;
+    }
+    else{
+        auto [minX, maxX] = minmax_element(world.x.begin(), world.x.end());
+        auto [minY, maxY] = minmax_element(world.y.begin(), world.y.end());
+        originX = *minX;
+        originY = *minY;
+        extentX = *maxX - *minX;
+        extentY = *maxY - *minY;
+    }
+    size_t maxPerSide = max<size_t>(1, size_t(2.0 * sqrt(double(n))));    // keeps the grid about the size of the bodies
+    auto cellsAlong = [&](float extent){
+        size_t cells = min(maxPerSide, size_t(max(1.0f, floor(extent / reach))));
+        if(periodic && cells < 3){
+            cells = 1;      // with fewer than three cells the neighbor stencil would visit cells twice
+        }
+        return cells;
+    };
+    size_t cellsX = cellsAlong(extentX), cellsY = cellsAlong(extentY);
+    float binX = max(extentX / cellsX, reach), binY = max(extentY / cellsY, reach);
+
+    // bucket the bodies by cell with a counting sort
+    Arena& arena = world.arenas().local(0);
+    unsigned* bodyCell = arena.allocateArray<unsigned>(n);
+    cellStart.assign(cellsX * cellsY + 1, 0);
+    for(size_t b = 0; b < n; b++){
+        long i = min<long>(cellsX - 1, max<long>(0, long((world.x[b] - originX) / binX)));
+        long j = min<long>(cellsY - 1, max<long>(0, long((world.y[b] - originY) / binY)));
+        bodyCell[b] = unsigned(j * cellsX + i);
+        cellStart[bodyCell[b] + 1]++;
+    }
+    for(size_t c = 0; c < cellsX * cellsY; c++){
+        cellStart[c + 1] += cellStart[c];
+    }
+    cellBodies.resize(n);
+    unsigned* fill = arena.allocateArray<unsigned>(cellsX * cellsY);
+    copy(cellStart.begin(), cellStart.end() - 1, fill);
+    for(size_t b = 0; b < n; b++){
+        cellBodies[fill[bodyCell[b]]++] = unsigned(b);
+    }
+
+    // every thread lists the pairs of its own slice of bodies, in order, so joining the
+    // threads' lists in thread order gives the same list on any number of threads
+    ThreadPool& pool = world.threadPool();
+    threadPairs.resize(pool.size());
+    for(vector<pair<unsigned, unsigned>>& found : threadPairs){
+        found.clear();
+    }
+    int reachX = cellsX == 1 ? 0 : 1, reachY = cellsY == 1 ? 0 : 1;
+    pool.run(n, [&](size_t begin, size_t end, unsigned thread){
+        vector<pair<unsigned, unsigned>>& found = threadPairs[thread];
+        for(size_t b = begin; b < end; b++){
+            size_t first = found.size();
+            long ci = bodyCell[b] % cellsX, cj = bodyCell[b] / cellsX;
+            for(long oj = -reachY; oj <= reachY; oj++){
+                for(long oi = -reachX; oi <= reachX; oi++){
+                    long i = ci + oi, j = cj + oj;
+                    if(periodic){
+                        i = (i + long(cellsX)) % long(cellsX);
+                        j = (j + long(cellsY)) % long(cellsY);
+                    }
+                    else if(i < 0 || j < 0 || i >= long(cellsX) || j >= long(cellsY)){
+                        continue;
+                    }
+                    size_t cell = j * cellsX + i;
+                    for(unsigned k = cellStart[cell]; k < cellStart[cell + 1]; k++){
+                        unsigned other = cellBodies[k];
+                        if(other <= b){
+                            continue;   // each pair once, from its lower index
+                        }
+                        float dx = world.x[other] - world.x[b];
+                        float dy = world.y[other] - world.y[b];
+                        boundary.minimumImage(dx, dy);
+                        float limit = range + skin + (withRadii ? world.radius[b] + world.radius[other] : 0.0f);
+                        if(dx * dx + dy * dy <= limit * limit){
+                            found.push_back({unsigned(b), other});
+                        }
+                    }
+                }
+            }
+            sort(found.begin() + first, found.end());
+        }
+    });
+    for(const vector<pair<unsigned, unsigned>>& found : threadPairs){
+        pairList.insert(pairList.end(), found.begin(), found.end());
+    }
+
+    // the same pairs seen from both bodies
+    for(const pair<unsigned, unsigned>& p : pairList){
+        neighborStart[p.first + 1]++;
+        neighborStart[p.second + 1]++;
+    }
+    for(size_t b = 0; b < n; b++){
+        neighborStart[b + 1] += neighborStart[b];
+    }
+    neighbors.resize(pairList.size() * 2);
+    unsigned* slot = arena.allocateArray<unsigned>(n);
+    copy(neighborStart.begin(), neighborStart.end() - 1, slot);
+    for(const pair<unsigned, unsigned>& p : pairList){
+        neighbors[slot[p.first]++] = p.second;
+        neighbors[slot[p.second]++] = p.first;
+    }
+}
+
+}
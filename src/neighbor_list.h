@@ -0,0 +1,52 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace gravity{
+
+class World;
+
+// Verlet neighbor list: every pair of bodies within an interaction range plus a skin,
+// found once with a cell grid and kept while it is still complete. A pair outside the
+// range plus skin at the build can only get within the range once the bodies have
+// closed the skin between them, so the list holds as long as no body has moved more
+// than half the skin (less whatever the range itself grew by). Bodies changing index
+// (World::layoutVersion) also force a rebuild.
+//
+// A bigger skin means rarer rebuilds but more pairs to check every step. Something a
+// little above the distance bodies travel in a few steps works well when neighbors
+// change slowly, as in granular runs.
+class NeighborList{
+public:
+    // Makes the list hold every pair closer than range, plus both bodies' radii when
+    // withRadii is set, rebuilding it with the given skin if the last build no longer
+    // covers that. Returns true if it rebuilt.
+    bool update(World& world, float range, bool withRadii, float skin);
+
+    // Each pair once, lower index first, sorted by the lower index and then the higher.
+    const std::vector<std::pair<unsigned, unsigned>>& pairs() const{ return pairList; }
+    // Every body listed as a neighbor of b, for loops that handle one body at a time.
+    const unsigned* neighborsBegin(size_t b) const{ return neighbors.data() + neighborStart[b]; }
+    const unsigned* neighborsEnd(size_t b) const{ return neighbors.data() + neighborStart[b + 1]; }
+
+    uint64_t builds() const{ return buildCount; }
+
+private:
+    bool covers(const World& world, float range, bool withRadii) const;
+    void build(World& world, float range, bool withRadii, float skin);
+
+    std::vector<float> builtX, builtY;      // positions at the last build
+    uint64_t builtFor = ~uint64_t(0);       // World::layoutVersion of the last build
+    float builtRange = 0.0f, builtSkin = 0.0f;
+    bool builtWithRadii = false;
+    uint64_t buildCount = 0;
+
+    std::vector<std::pair<unsigned, unsigned>> pairList;
+    std::vector<std::vector<std::pair<unsigned, unsigned>>> threadPairs;
+    std::vector<unsigned> neighborStart, neighbors;
+    std::vector<unsigned> cellStart, cellBodies;
+};
+
+}
@@ -0,0 +1,139 @@
+#include "numa.h"
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+namespace gravity{
+
+// "0-3,8-11" style lists of CPUs or nodes from /sys
+static vector<unsigned> ParseList(const string& text){
+    vector<unsigned> values;
+    stringstream list(text);
+    string range;
+    while(getline(list, range, ',')){
+        if(range.empty()){
+            continue;
+        }
+        size_t dash = range.find('-');
+        unsigned first = unsigned(stoul(range.substr(0, dash)));
+        unsigned last = dash == string::npos ? first : unsigned(stoul(range.substr(dash + 1)));
+        for(unsigned value = first; value <= last; value++){
+            values.push_back(value);
+        }
+    }
+    return values;
+}
+
+static NumaTopology ReadTopology(){
+    NumaTopology topology;
+#ifdef __linux__
+    ifstream online("/sys/devices/system/node/online");
+    string nodes;
+    if(online && getline(online, nodes)){
+        for(unsigned node : ParseList(nodes)){
+            ifstream file("/sys/devices/system/node/node" + to_string(node) + "/cpulist");
+            string cpus;
+            getline(file, cpus);
+            if(topology.nodeCpus.size() <= node){
+                topology.nodeCpus.resize(node + 1);
+            }
+            topology.nodeCpus[node] = ParseList(cpus);
+        }
+    }
+#endif
+    if(topology.nodeCpus.empty()){
+        vector<unsigned> all(max(1u, thread::hardware_concurrency()));
+        for(unsigned cpu = 0; cpu < all.size(); cpu++){
+            all[cpu] = cpu;
+        }
+        topology.nodeCpus.push_back(all);
+    }
+    return topology;
+}
+
+const NumaTopology& Topology(){
+    static const NumaTopology topology = ReadTopology();
+    return topology;
+}
+
+void ThreadPlacement(unsigned thread, unsigned threads, unsigned& node, unsigned& cpu){
+    const NumaTopology& topology = Topology();
+    // nodes without CPUs (memory only) get no threads
+    vector<unsigned> usable;
+    for(unsigned n = 0; n < topology.nodes(); n++){
+        if(!topology.nodeCpus[n].empty()){
+            usable.push_back(n);
+        }
+    }
+    if(usable.empty()){
+        node = 0;
+        cpu = thread;
+        return;
+    }
+    size_t block = size_t(thread) * usable.size() / max(1u, threads);
+    node = usable[block];
+    size_t firstThread = (block * threads + usable.size() - 1) / usable.size();    // first thread in this node's block
+    const vector<unsigned>& cpus = topology.nodeCpus[node];
+    cpu = cpus[(thread - firstThread) % cpus.size()];
+}
+
+#ifdef __linux__
+bool PinThread(unsigned cpu){
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+ScopedPin::ScopedPin(unsigned cpu){
+    static_assert(sizeof(savedMask) == sizeof(cpu_set_t), "savedMask has to hold a cpu_set_t");
+    saved = pthread_getaffinity_np(pthread_self(), sizeof(savedMask), reinterpret_cast<cpu_set_t*>(savedMask)) == 0
+        && PinThread(cpu);
+}
+
+ScopedPin::~ScopedPin(){
+    if(saved){
+        pthread_setaffinity_np(pthread_self(), sizeof(savedMask), reinterpret_cast<const cpu_set_t*>(savedMask));
+    }
+}
+
+bool PlaceOnNode(void* memory, size_t bytes, unsigned node){
+    const long MPOL_PREFERRED = 1;          // from linux/mempolicy.h, which is not always installed
+    const unsigned MPOL_MF_MOVE = 1 << 1;
+    uintptr_t page = uintptr_t(sysconf(_SC_PAGESIZE));
+    uintptr_t begin = (uintptr_t(memory) + page - 1) / page * page;
+    uintptr_t end = (uintptr_t(memory) + bytes) / page * page;
+    if(begin >= end){
+        return true;    // shares all its pages with neighbouring slices
+    }
+    vector<unsigned long> mask(node / 64 + 1, 0);
+    mask[node / 64] = 1ul << (node % 64);
+    return syscall(SYS_mbind, begin, end - begin, MPOL_PREFERRED, mask.data(), mask.size() * 64 + 1, MPOL_MF_MOVE) == 0;
+}
+#else
+bool PinThread(unsigned){
+    return false;
+}
+
+ScopedPin::ScopedPin(unsigned){}
+
+ScopedPin::~ScopedPin(){}
+
+bool PlaceOnNode(void*, size_t, unsigned){
+    return false;
+}
+#endif
+
+}
@@ -0,0 +1,45 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace gravity{
+
+// NUMA nodes and the CPUs of each, read from /sys on Linux. Elsewhere everything is
+// one node holding every CPU, and the calls below do nothing.
+struct NumaTopology{
+    std::vector<std::vector<unsigned>> nodeCpus;
+
+    unsigned nodes() const{ return unsigned(nodeCpus.size()); }
+};
+
+const NumaTopology& Topology();
+
+// Where thread `thread` of a pinned pool of `threads` runs. Threads are handed to nodes
+// in contiguous blocks, so the contiguous body slices that ThreadPool::run gives
+// neighbouring threads also land on one node.
+void ThreadPlacement(unsigned thread, unsigned threads, unsigned& node, unsigned& cpu);
+
+// Pins the calling thread to one CPU. Returns false if that is not supported here.
+bool PinThread(unsigned cpu);
+
+// Pins the calling thread to one CPU for the lifetime of the object and then gives it
+// back the CPUs it was allowed on before. For threads that are not the pool's own,
+// since threads started later inherit their creator's affinity.
+class ScopedPin{
+public:
+    explicit ScopedPin(unsigned cpu);
+    ~ScopedPin();
+    ScopedPin(const ScopedPin&) = delete;
+    ScopedPin& operator=(const ScopedPin&) = delete;
+
+private:
+    bool saved = false;
+    uint64_t savedMask[16];     // the size of a Linux cpu_set_t
+};
+
+// Moves the pages lying wholly inside [memory, memory + bytes) to node, and keeps later
+// faults there. Returns false if that is not supported here.
+bool PlaceOnNode(void* memory, size_t bytes, unsigned node);
+
+}
@@ -0,0 +1,176 @@
+#include "octree.h"
+#include "parallel.h"
+#include "world3d.h"
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+
+namespace gravity{
+
+void Octree::build(const World3D& world){
+    size_t n = world.size();
+    nodes.clear();
+    order.resize(n);
+    for(size_t i = 0; i < n; i++){
+        order[i] = uint32_t(i);
+    }
+    if(n == 0){
+        return;
+    }
+    float minX = world.x[0], maxX = minX, minY = world.y[0], maxY = minY, minZ = world.z[0], maxZ = minZ;
+    for(size_t i = 1; i < n; i++){
+        minX = min(minX, world.x[i]); maxX = max(maxX, world.x[i]);
+        minY = min(minY, world.y[i]); maxY = max(maxY, world.y[i]);
+        minZ = min(minZ, world.z[i]); maxZ = max(maxZ, world.z[i]);
+    }
+    Node root = {};
+    root.centerX = 0.5f * (minX + maxX);
+    root.centerY = 0.5f * (minY + maxY);
+    root.centerZ = 0.5f * (minZ + maxZ);
+    root.halfSize = 0.5f * max(max(maxX - minX, maxY - minY), maxZ - minZ) * 1.0001f + 1e-6f;   // every body strictly inside
+    root.begin = 0;
+    root.end = uint32_t(n);
+    nodes.push_back(root);
+    split(world, 0, 0);
+}
+
+void Octree::split(const World3D& world, uint32_t index, int depth){
+    Node node = nodes[index];
+    if(node.end - node.begin <= LEAF_BODIES || depth >= MAX_DEPTH){
+        float mass = 0.0f, mx = 0.0f, my = 0.0f, mz = 0.0f;
+        for(uint32_t k = node.begin; k < node.end; k++){
+            uint32_t i = order[k];
+            mass += world.mass[i];
+            mx += world.mass[i] * world.x[i];
+            my += world.mass[i] * world.y[i];
+            mz += world.mass[i] * world.z[i];
+        }
+        Node& leaf = nodes[index];
+        leaf.mass = mass;
+        leaf.massX = mass > 0.0f ? mx / mass : node.centerX;
+        leaf.massY = mass > 0.0f ? my / mass : node.centerY;
+        leaf.massZ = mass > 0.0f ? mz / mass : node.centerZ;
+        return;
+    }
+
+    // counting sort of the node's bodies by octant, bit 0 for x, 1 for y, 2 for z
+    uint32_t counts[8] = {};
+    auto octant = [&](uint32_t i){
+        return (world.x[i] >= node.centerX ? 1u : 0u) | (world.y[i] >= node.centerY ? 2u : 0u) | (world.z[i] >= node.centerZ ? 4u : 0u);
+    };
+    for(uint32_t k = node.begin; k < node.end; k++){
+        counts[octant(order[k])]++;
+    }
+    uint32_t starts[8];
+    uint32_t next = node.begin;
+    for(int c = 0; c < 8; c++){
+        starts[c] = next;
+        next += counts[c];
+    }
+    scratch.resize(node.end - node.begin);
+    uint32_t fill[8];
+    copy(starts, starts + 8, fill);
+    for(uint32_t k = node.begin; k < node.end; k++){
+        uint32_t i = order[k];
+        scratch[fill[octant(i)]++ - node.begin] = i;
+    }
+    copy(scratch.begin(), scratch.end(), order.begin() + node.begin);
+
+    // children of one node are consecutive, so they are all added before any is split
+    uint32_t firstChild = uint32_t(nodes.size());
+    float quarter = 0.5f * node.halfSize;
+    for(int c = 0; c < 8; c++){
+        if(counts[c] == 0){
+            continue;
+        }
+        Node child = {};
+        child.centerX = node.centerX + (c & 1 ? quarter : -quarter);
+        child.centerY = node.centerY + (c & 2 ? quarter : -quarter);
+        child.centerZ = node.centerZ + (c & 4 ? quarter : -quarter);
+        child.halfSize = quarter;
+        child.begin = starts[c];
+        child.end = starts[c] + counts[c];
+        nodes.push_back(child);
+    }
+    uint32_t childCount = uint32_t(nodes.size()) - firstChild;
+    float mass = 0.0f, mx = 0.0f, my = 0.0f, mz = 0.0f;
+    for(uint32_t c = 0; c < childCount; c++){
+        split(world, firstChild + c, depth + 1);
+        const Node& child = nodes[firstChild + c];
+        mass += child.mass;
+        mx += child.mass * child.massX;
+        my += child.mass * child.massY;
+        mz += child.mass * child.massZ;
+    }
+    Node& parent = nodes[index];
+    parent.firstChild = firstChild;
+    parent.childCount = childCount;
+    parent.mass = mass;
+    parent.massX = mass > 0.0f ? mx / mass : node.centerX;
+    parent.massY = mass > 0.0f ? my / mass : node.centerY;
+    parent.massZ = mass > 0.0f ? mz / mass : node.centerZ;
+}
+
+void Octree::accelerate(const World3D& world, size_t i, float& ax, float& ay, float& az) const{
+    const float G = world.config.gravitationalConstant;
+    const float theta2 = world.config.openingAngle * world.config.openingAngle;
+    const float px = world.x[i], py = world.y[i], pz = world.z[i];
+    uint32_t stack[8 * MAX_DEPTH + 8];
+    int top = 0;
+    stack[top++] = 0;
+    while(top > 0){
+        const Node& node = nodes[stack[--top]];
+        if(node.mass == 0.0f){
+            continue;
+        }
+        if(node.childCount == 0){   // leaf: exact sum
+            for(uint32_t k = node.begin; k < node.end; k++){
+                uint32_t j = order[k];
+                float dx = world.x[j] - px, dy = world.y[j] - py, dz = world.z[j] - pz;
+                if(dx == 0.0f && dy == 0.0f && dz == 0.0f){     // same body, or one on top of it
+                    continue;
+                }
+                float distance = sqrt(dx * dx + dy * dy + dz * dz);
+                float scale = G * world.mass[j] / (distance * distance * distance);
+                ax += dx * scale;
+                ay += dy * scale;
+                az += dz * scale;
+            }
+            continue;
+        }
+        float dx = node.massX - px, dy = node.massY - py, dz = node.massZ - pz;
+        float distanceSquared = dx * dx + dy * dy + dz * dz;
+        float size = 2.0f * node.halfSize;
+        bool inside = fabs(px - node.centerX) <= node.halfSize && fabs(py - node.centerY) <= node.halfSize
+            && fabs(pz - node.centerZ) <= node.halfSize;
+        if(!inside && size * size < theta2 * distanceSquared){  // far enough to be one point
+            float distance = sqrt(distanceSquared);
+            float scale = G * node.mass / (distanceSquared * distance);
+            ax += dx * scale;
+            ay += dy * scale;
+            az += dz * scale;
+            continue;
+        }
+        for(uint32_t c = 0; c < node.childCount; c++){
+            stack[top++] = node.firstChild + c;
+        }
+    }
+}
+
+void Octree::computeForces(World3D& world, ThreadPool& pool) const{
+    if(nodes.empty()){
+        return;
+    }
+    pool.run(world.size(), [&](size_t begin, size_t end, unsigned){    // each body only writes its own acceleration
+        for(size_t i = begin; i < end; i++){
+            float ax = 0.0f, ay = 0.0f, az = 0.0f;
+            accelerate(world, i, ax, ay, az);
+            world.ax[i] += ax;
+            world.ay[i] += ay;
+            world.az[i] += az;
+        }
+    }, 64);
+}
+
+}
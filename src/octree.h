@@ -0,0 +1,43 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace gravity{
+
+class World3D;
+class ThreadPool;
+
+// Barnes-Hut octree over the bodies of a World3D. Every node keeps the total mass and
+// center of mass of the bodies below it; a node that looks small enough from a body,
+// size / distance < openingAngle, pulls on it as a single point. Leaves hold a few
+// bodies each, summed exactly.
+class Octree{
+public:
+    void build(const World3D& world);
+    // Adds the pull on every body to its acceleration; the tree has to be built from the same positions.
+    void computeForces(World3D& world, ThreadPool& pool) const;
+
+private:
+    struct Node{
+        float centerX, centerY, centerZ;    // middle of the cube
+        float halfSize;
+        float massX, massY, massZ;          // center of mass
+        float mass;
+        uint32_t firstChild;    // index of the first of childCount consecutive nodes, 0 for a leaf
+        uint32_t childCount;
+        uint32_t begin, end;    // range of bodies in order
+    };
+
+    static constexpr uint32_t LEAF_BODIES = 8;
+    static constexpr int MAX_DEPTH = 32;    // bodies on top of each other end up in one deep leaf
+
+    void split(const World3D& world, uint32_t node, int depth);
+    void accelerate(const World3D& world, size_t i, float& ax, float& ay, float& az) const;
+
+    std::vector<Node> nodes;
+    std::vector<uint32_t> order;    // body indices grouped by leaf
+    std::vector<uint32_t> scratch;  // order of the node being split, by octant
+};
+
+}
@@ -0,0 +1,59 @@
+#include "offscreen.h"
+#include "snapshot.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+using namespace std;
+
+namespace gravity{
+
+void Image::resize(int width, int height){
+    this->width = width;
+    this->height = height;
+    rgb.resize(size_t(width) * height * 3);
+    depth.resize(size_t(width) * height);
+}
+
+void Image::clear(){
+    fill(rgb.begin(), rgb.end(), 0);
+    fill(depth.begin(), depth.end(), INFINITY);
+}
+
+void RenderDiscs(const DrawView& bodies, Image& image){
+    image.clear();
+    float halfWidth = 0.5f * image.width, halfHeight = 0.5f * image.height;
+    for(size_t i = 0; i < bodies.count; i++){
+        float centerX = (bodies.x[i] + 1.0f) * halfWidth;
+        float centerY = (1.0f - bodies.y[i]) * halfHeight;
+        float radiusX = max(bodies.radius[i] * halfWidth, 0.5f), radiusY = max(bodies.radius[i] * halfHeight, 0.5f);
+        int left = max(0, int(floor(centerX - radiusX)));
+        int right = min(image.width - 1, int(ceil(centerX + radiusX)));
+        int top = max(0, int(floor(centerY - radiusY)));
+        int bottom = min(image.height - 1, int(ceil(centerY + radiusY)));
+        uint8_t color[3] = {uint8_t(min(255.0f, bodies.red[i] * 255.0f)), uint8_t(min(255.0f, bodies.green[i] * 255.0f)),
+            uint8_t(min(255.0f, bodies.blue[i] * 255.0f))};
+        for(int row = top; row <= bottom; row++){
+            for(int column = left; column <= right; column++){
+                float u = (column + 0.5f - centerX) / radiusX;
+                float v = (row + 0.5f - centerY) / radiusY;
+                if(u * u + v * v <= 1.0f){
+                    memcpy(&image.rgb[(size_t(row) * image.width + column) * 3], color, 3);     // later bodies on top, as in GL
+                }
+            }
+        }
+    }
+}
+
+bool WritePpm(const Image& image, const string& path){
+    FILE* file = fopen(path.c_str(), "wb");
+    if(!file){
+        return false;
+    }
+    fprintf(file, "P6\n%d %d\n255\n", image.width, image.height);
+    bool ok = fwrite(image.rgb.data(), 1, image.rgb.size(), file) == image.rgb.size();
+    return fclose(file) == 0 && ok;
+}
+
+}
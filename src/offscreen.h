@@ -0,0 +1,28 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Software rendering for runs without a window: an image in memory, the 2D discs drawn
+// into it, and PPM output. RenderSpheres in viewer3d.h draws 3D worlds into the same image.
+namespace gravity{
+
+struct DrawView;
+
+// RGB image with a depth buffer, rows from the top.
+struct Image{
+    int width = 0, height = 0;
+    std::vector<uint8_t> rgb;
+    std::vector<float> depth;
+
+    void resize(int width, int height);
+    void clear();
+};
+
+// Draws every body as a flat disc the way the 2D window does, [-1, 1] spanning the image.
+void RenderDiscs(const DrawView& bodies, Image& image);
+
+// Binary PPM (P6), readable by most image tools.
+bool WritePpm(const Image& image, const std::string& path);
+
+}
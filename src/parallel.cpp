@@ -0,0 +1,108 @@
+#include "parallel.h"
+#include "numa.h"
+#include <algorithm>
+
+using namespace std;
+
+namespace gravity{
+
+void SliceRange(size_t count, unsigned thread, unsigned threads, size_t grain, size_t& begin, size_t& end){
+    size_t blocks = (count + grain - 1) / grain;
+    size_t perThread = blocks / threads, extra = blocks % threads;
+    size_t firstBlock = thread * perThread + min<size_t>(thread, extra);
+    size_t blockCount = perThread + (thread < extra ? 1 : 0);
+    begin = min(count, firstBlock * grain);
+    end = min(count, (firstBlock + blockCount) * grain);
+}
+
+ThreadPool::ThreadPool(unsigned threads, bool pinned){
+    threadCount = max(1u, threads);
+    isPinned = pinned;
+    threadNode.assign(threadCount, 0);
+    threadCpu.assign(threadCount, 0);
+    if(pinned){
+        for(unsigned t = 0; t < threadCount; t++){
+            ThreadPlacement(t, threadCount, threadNode[t], threadCpu[t]);
+        }
+    }
+    for(unsigned t = 1; t < threadCount; t++){
+        workers.emplace_back(&ThreadPool::worker, this, t);
+    }
+}
+
+ThreadPool::~ThreadPool(){
+    {
+        lock_guard<mutex> lock(poolMutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for(thread& t : workers){
+        t.join();
+    }
+}
+
+void ThreadPool::run(size_t count, TaskRef task, size_t grain){
+    if(threadCount == 1 || count <= grain){
+        task(0, count, 0);
+        return;
+    }
+    {
+        lock_guard<mutex> lock(poolMutex);
+        job = &task;
+        jobCount = count;
+        jobGrain = max<size_t>(1, grain);
+        pending = threadCount - 1;
+        generation++;
+    }
+    wake.notify_all();
+
+    size_t begin, end;
+    SliceRange(count, 0, threadCount, jobGrain, begin, end);
+    if(begin < end){
+        if(isPinned){
+            ScopedPin pin(threadCpu[0]);
+            task(begin, end, 0);
+        }
+        else{
+            task(begin, end, 0);
+        }
+    }
+
+    unique_lock<mutex> lock(poolMutex);
+    done.wait(lock, [this]{ return pending == 0; });
+    job = nullptr;
+}
+
+void ThreadPool::worker(unsigned thread){
+    if(isPinned){
+        PinThread(threadCpu[thread]);
+    }
+    unsigned seen = 0;
+    while(true){
+        const TaskRef* task;
+        size_t count, grain;
+        {
+            unique_lock<mutex> lock(poolMutex);
+            wake.wait(lock, [&]{ return stopping || generation != seen; });
+            if(stopping){
+                return;
+            }
+            seen = generation;
+            task = job;
+            count = jobCount;
+            grain = jobGrain;
+        }
+        size_t begin, end;
+        SliceRange(count, thread, threadCount, grain, begin, end);
+        if(begin < end){
+            (*task)(begin, end, thread);
+        }
+        {
+            lock_guard<mutex> lock(poolMutex);
+            pending--;
+        }
+        done.notify_one();
+    }
+}
+
+}
@@ -0,0 +1,67 @@
+#pragma once
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace gravity{
+
+// Borrowed reference to a task(begin, end, thread) callable. Unlike std::function it never
+// copies the callable, so passing a lambda with many captures to run() does not allocate.
+// The callable has to outlive the call it is passed to.
+class TaskRef{
+public:
+    template<class F> TaskRef(const F& task) : object(&task), invoke(&Call<F>){}
+    void operator()(size_t begin, size_t end, unsigned thread) const{ invoke(object, begin, end, thread); }
+
+private:
+    template<class F> static void Call(const void* task, size_t begin, size_t end, unsigned thread){
+        (*static_cast<const F*>(task))(begin, end, thread);
+    }
+    const void* object;
+    void (*invoke)(const void*, size_t, size_t, unsigned);
+};
+
+// Fixed set of worker threads that split a range of indices between them. The
+// calling thread takes part in the work, so a pool of 1 runs everything inline.
+//
+// A pinned pool fixes every worker to one CPU, filling NUMA nodes in order (see
+// ThreadPlacement). The calling thread is thread 0 and is only pinned while it works
+// inside run(), so threads it starts elsewhere are not stuck on that CPU. Since run()
+// hands out contiguous slices in thread order, each node then works on one contiguous
+// part of every array.
+class ThreadPool{
+public:
+    explicit ThreadPool(unsigned threads = std::thread::hardware_concurrency(), bool pinned = false);
+    ~ThreadPool();
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    unsigned size() const{ return threadCount; }
+    bool pinned() const{ return isPinned; }
+    unsigned node(unsigned thread) const{ return threadNode[thread]; }     // 0 unless pinned
+
+    // Calls task(begin, end, thread) on contiguous slices of [0, count) and waits for all
+    // of them. Slice boundaries are rounded to multiples of grain.
+    void run(size_t count, TaskRef task, size_t grain = 1);
+
+private:
+    void worker(unsigned thread);
+
+    unsigned threadCount;
+    bool isPinned;
+    std::vector<unsigned> threadNode, threadCpu;
+    std::vector<std::thread> workers;
+    std::mutex poolMutex;
+    std::condition_variable wake, done;
+    const TaskRef* job = nullptr;
+    size_t jobCount = 0, jobGrain = 1;
+    unsigned generation = 0, pending = 0;
+    bool stopping = false;
+};
+
+// Slice [begin, end) of count items that thread `thread` out of `threads` gets.
+void SliceRange(size_t count, unsigned thread, unsigned threads, size_t grain, size_t& begin, size_t& end);
+
+}
@@ -0,0 +1,384 @@
+#include "pm_solver.h"
+#include "gravity.h"
+#include "parallel.h"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+using namespace std;
+
+namespace gravity{
+
+static const double PI = 3.14159265358979323846;
+
+// In-place radix-2 FFT of n values spaced stride apart, using n values of scratch.
+static void FFT(complex<double>* data, size_t n, size_t stride, bool inverse, complex<double>* scratch){
+    for(size_t i = 0, j = 0; i < n; i++){   // bit reversed copy
+        scratch[j] = data[i * stride];
+        for(size_t bit = n >> 1; bit > 0; bit >>= 1){
+            j ^= bit;
+            if(j & bit){
+                break;
+            }
+        }
+    }
+    for(size_t length = 2; length <= n; length <<= 1){
+        double angle = (inverse ? 2.0 : -2.0) * PI / length;
+        complex<double> rotate(cos(angle), sin(angle));
+        for(size_t start = 0; start < n; start += length){
+            complex<double> w(1.0, 0.0);
+            for(size_t k = 0; k < length / 2; k++){
+                complex<double> even = scratch[start + k];
+                complex<double> odd = scratch[start + k + length / 2] * w;
+                scratch[start + k] = even + odd;
+                scratch[start + k + length / 2] = even - odd;
+                w *= rotate;
+            }
+        }
+    }
+    for(size_t i = 0; i < n; i++){
+        data[i * stride] = scratch[i];
+    }
+}
+
+void ParticleMesh::transform(vector<complex<double>>& data, bool inverse, ThreadPool& pool, StepArenas& arenas){
+    size_t n = points;
+    pool.run(n, [&](size_t begin, size_t end, unsigned thread){    // rows
+        complex<double>* scratch = arenas.local(thread).allocateArray<complex<double>>(n);
+        for(size_t row = begin; row < end; row++){
+            FFT(&data[row * n], n, 1, inverse, scratch);
+        }
+    });
+    pool.run(n, [&](size_t begin, size_t end, unsigned thread){    // columns
+        complex<double>* scratch = arenas.local(thread).allocateArray<complex<double>>(n);
+        for(size_t column = begin; column < end; column++){
+            FFT(&data[column], n, n, inverse, scratch);
+        }
+    });
+}
+
+// Potential of a unit mass at distance r with only the long range part of the split kept.
+static double LongRangePotential(double r, double G, double splitScale){
+    if(r == 0.0){
+        return -G / (splitScale * sqrt(PI));
+    }
+    return -G * erf(r / (2.0 * splitScale)) / r;
+}
+
+void ParticleMesh::buildKernel(const World& world, ThreadPool& pool, StepArenas& arenas){
+    float G = world.config.gravitationalConstant;
+    if(kernelPoints == points && kernelPeriodic == periodic && kernelCellSize == cellSize
+        && kernelSplitScale == splitScale && kernelG == G){
+        return;
+    }
+    size_t n = points;
+    kernel.assign(n * n, 0.0);
+    for(size_t j = 0; j < n; j++){
+        for(size_t i = 0; i < n; i++){
+            // offsets past the middle wrap around to negative ones, for both the periodic
+            // grid (nearest image) and the padded one (the far half is never sampled)
+            double dx = (i <= n / 2 ? double(i) : double(i) - n) * cellSize;
+            double dy = (j <= n / 2 ? double(j) : double(j) - n) * cellSize;
+            kernel[j * n + i] = LongRangePotential(sqrt(dx * dx + dy * dy), G, splitScale);
+        }
+    }
+    selfPotential[0] = LongRangePotential(0.0, G, splitScale);
+    selfPotential[1] = LongRangePotential(cellSize, G, splitScale);
+    selfPotential[2] = LongRangePotential(sqrt(2.0) * cellSize, G, splitScale);
+    transform(kernel, false, pool, arenas);
+    kernelPoints = n;
+    kernelPeriodic = periodic;
+    kernelCellSize = cellSize;
+    kernelSplitScale = splitScale;
+    kernelG = G;
+}
+
+void ParticleMesh::deposit(const World& world, ThreadPool& pool){
+    size_t n = points;
+    threadMass.resize(pool.size());
+    pool.run(world.size(), [&](size_t begin, size_t end, unsigned thread){
+        vector<double>& mass = threadMass[thread];
+        mass.assign(n * n, 0.0);
+        for(size_t b = begin; b < end; b++){
+            float u = (world.x[b] - originX) / cellSize - 0.5f;    // grid points sit at cell centers
+            float v = (world.y[b] - originY) / cellSize - 0.5f;
+            float cellU = floor(u), cellV = floor(v);
+            float fu = u - cellU, fv = v - cellV;
+            long i0 = long(cellU), j0 = long(cellV);
+            for(int dj = 0; dj < 2; dj++){
+                for(int di = 0; di < 2; di++){
+                    long i = (i0 + di + long(n)) % long(n);
+                    long j = (j0 + dj + long(n)) % long(n);
+                    float weight = (di ? fu : 1.0f - fu) * (dj ? fv : 1.0f - fv);
+                    mass[j * n + i] += world.mass[b] * weight;
+                }
+            }
+        }
+    });
+    grid.assign(n * n, 0.0);
+    pool.run(n * n, [&](size_t begin, size_t end, unsigned){
+        for(const vector<double>& mass : threadMass){
+            if(mass.empty()){
+                continue;
+            }
+            for(size_t c = begin; c < end; c++){
+                grid[c] += mass[c];
+            }
+        }
+    });
+    for(vector<double>& mass : threadMass){
+        mass.clear();   // threads that got no bodies this step must not add stale mass next step
+    }
+}
+
+// The sums of deposit() with every grid point adding its bodies in body order, so they come
+// out the same on any number of threads. Bodies are bucketed by the grid row below them,
+// in body order; a row then takes its own bucket and the one below, merged by body index.
+void ParticleMesh::depositOrdered(const World& world, ThreadPool& pool, Arena& arena){
+    size_t n = points, count = world.size();
+    uint32_t* column = arena.allocateArray<uint32_t>(count);   // grid point left of and below the body
+    uint32_t* row = arena.allocateArray<uint32_t>(count);
+    float* fu = arena.allocateArray<float>(count);
+    float* fv = arena.allocateArray<float>(count);
+    pool.run(count, [&](size_t begin, size_t end, unsigned){
+        for(size_t b = begin; b < end; b++){
+            float u = (world.x[b] - originX) / cellSize - 0.5f;    // exactly as in deposit()
+            float v = (world.y[b] - originY) / cellSize - 0.5f;
+            float cellU = floor(u), cellV = floor(v);
+            fu[b] = u - cellU;
+            fv[b] = v - cellV;
+            column[b] = uint32_t((long(cellU) + long(n)) % long(n));
+            row[b] = uint32_t((long(cellV) + long(n)) % long(n));
+        }
+    });
+    size_t* rowStart = arena.allocateArray<size_t>(n + 1);
+    size_t* rowEnd = arena.allocateArray<size_t>(n);
+    uint32_t* rowBodies = arena.allocateArray<uint32_t>(count);
+    fill(rowStart, rowStart + n + 1, 0);
+    for(size_t b = 0; b < count; b++){
+        rowStart[row[b] + 1]++;
+    }
+    for(size_t j = 0; j < n; j++){
+        rowStart[j + 1] += rowStart[j];
+    }
+    copy(rowStart, rowStart + n, rowEnd);
+    for(size_t b = 0; b < count; b++){
+        rowBodies[rowEnd[row[b]]++] = uint32_t(b);
+    }
+
+    grid.assign(n * n, 0.0);
+    pool.run(n, [&](size_t begin, size_t end, unsigned){
+        for(size_t j = begin; j < end; j++){
+            size_t below = (j + n - 1) % n;
+            const uint32_t *own = rowBodies + rowStart[j], *ownEnd = rowBodies + rowStart[j + 1];
+            const uint32_t *under = rowBodies + rowStart[below], *underEnd = rowBodies + rowStart[below + 1];
+            complex<double>* gridRow = &grid[j * n];
+            while(own != ownEnd || under != underEnd){
+                bool fromOwn = under == underEnd || (own != ownEnd && *own < *under);
+                uint32_t b = fromOwn ? *own++ : *under++;
+                float rowWeight = fromOwn ? 1.0f - fv[b] : fv[b];
+                for(int di = 0; di < 2; di++){
+                    float weight = (di ? fu[b] : 1.0f - fu[b]) * rowWeight;
+                    gridRow[(column[b] + di) % n] += world.mass[b] * weight;
+                }
+            }
+        }
+    });
+}
+
+void ParticleMesh::interpolate(World& world, ThreadPool& pool){
+    size_t n = points;
+    forceX.resize(n * n);
+    forceY.resize(n * n);
+    pool.run(n, [&](size_t begin, size_t end, unsigned){    // acceleration is minus the potential gradient
+        for(size_t j = begin; j < end; j++){
+            size_t up = (j + 1) % n, down = (j + n - 1) % n;
+            for(size_t i = 0; i < n; i++){
+                size_t right = (i + 1) % n, left = (i + n - 1) % n;
+                forceX[j * n + i] = float(-(grid[j * n + right].real() - grid[j * n + left].real()) / (2.0 * cellSize));
+                forceY[j * n + i] = float(-(grid[up * n + i].real() - grid[down * n + i].real()) / (2.0 * cellSize));
+            }
+        }
+    });
+    pool.run(world.size(), [&](size_t begin, size_t end, unsigned){
+        for(size_t b = begin; b < end; b++){
+            float u = (world.x[b] - originX) / cellSize - 0.5f;
+            float v = (world.y[b] - originY) / cellSize - 0.5f;
+            float cellU = floor(u), cellV = floor(v);
+            float fu = u - cellU, fv = v - cellV;
+            long i0 = long(cellU), j0 = long(cellV);
+            for(int dj = 0; dj < 2; dj++){
+                for(int di = 0; di < 2; di++){
+                    long i = (i0 + di + long(n)) % long(n);
+                    long j = (j0 + dj + long(n)) % long(n);
+                    float weight = (di ? fu : 1.0f - fu) * (dj ? fv : 1.0f - fv);
+                    world.ax[b] += forceX[j * n + i] * weight;
+                    world.ay[b] += forceY[j * n + i] * weight;
+                    if(world.computePotential){
+                        world.potential[b] += float(grid[j * n + i].real() * weight);
+                    }
+                }
+            }
+            if(world.computePotential){     // remove the body's own cloud from its potential
+                float w00 = (1 - fu) * (1 - fv), w10 = fu * (1 - fv), w01 = (1 - fu) * fv, w11 = fu * fv;
+                double self = (w00 * w00 + w10 * w10 + w01 * w01 + w11 * w11) * selfPotential[0]
+                    + 2.0 * (w00 * w10 + w01 * w11 + w00 * w01 + w10 * w11) * selfPotential[1]
+                    + 2.0 * (w00 * w11 + w10 * w01) * selfPotential[2];
+                world.potential[b] -= float(world.mass[b] * self);
+            }
+        }
+    });
+}
+
+void ParticleMesh::shortRangeForces(World& world, ThreadPool& pool){
+    const Boundary& boundary = world.config.boundary;
+    float G = world.config.gravitationalConstant;
+    float cutoff = splitScale * world.config.mesh.cutoffSplits;
+    float extent = cells * cellSize;
+    size_t perSide = max<size_t>(1, size_t(extent / cutoff));
+    if(perSide < 3){
+        perSide = 1;    // with fewer than three cells the neighbor stencil would visit cells twice
+    }
+    float binSize = extent / perSide;
+    size_t n = world.size();
+    double cutoffSquared = double(cutoff) * cutoff;
+
+    // the erfc part of the force other exerts on b, if it is within the cutoff
+    auto addPair = [&](size_t b, unsigned other){
+        float dx = world.x[other] - world.x[b];
+        float dy = world.y[other] - world.y[b];
+        boundary.minimumImage(dx, dy);
+        double distanceSquared = double(dx) * dx + double(dy) * dy;
+        if(distanceSquared >= cutoffSquared || distanceSquared == 0.0){
+            return;
+        }
+        double r = sqrt(distanceSquared);
+        double s = r / (2.0 * splitScale);
+        double shortPart = erfc(s) + (r / (splitScale * sqrt(PI))) * exp(-s * s);
+        double scale = G * world.mass[other] * shortPart / (distanceSquared * r);
+        world.ax[b] += float(dx * scale);
+        world.ay[b] += float(dy * scale);
+        if(world.computePotential){
+            world.potential[b] -= float(G * world.mass[other] * erfc(s) / r);
+        }
+    };
+
+    if(world.config.mesh.neighborList){
+        shortRangePairs.update(world, cutoff, false, world.config.neighborSkin);
+        pool.run(n, [&](size_t begin, size_t end, unsigned){
+            for(size_t b = begin; b < end; b++){
+                for(const unsigned* other = shortRangePairs.neighborsBegin(b); other != shortRangePairs.neighborsEnd(b); other++){
+                    addPair(b, *other);
+                }
+            }
+        });
+        return;
+    }
+
+    // bucket the bodies by cell with a counting sort
+    Arena& arena = world.arenas().local(0);
+    unsigned* bodyCell = arena.allocateArray<unsigned>(n);
+    cellStart.assign(perSide * perSide + 1, 0);
+    for(size_t b = 0; b < n; b++){
+        long i = min<long>(perSide - 1, max<long>(0, long((world.x[b] - originX) / binSize)));
+        long j = min<long>(perSide - 1, max<long>(0, long((world.y[b] - originY) / binSize)));
+        bodyCell[b] = unsigned(j * perSide + i);
+        cellStart[bodyCell[b] + 1]++;
+    }
+    for(size_t c = 0; c < perSide * perSide; c++){
+        cellStart[c + 1] += cellStart[c];
+    }
+    cellBodies.resize(n);
+    unsigned* fill = arena.allocateArray<unsigned>(perSide * perSide);
+    copy(cellStart.begin(), cellStart.end() - 1, fill);
+    for(size_t b = 0; b < n; b++){
+        cellBodies[fill[bodyCell[b]]++] = unsigned(b);
+    }
+
+    pool.run(n, [&](size_t begin, size_t end, unsigned){
+        for(size_t b = begin; b < end; b++){
+            long ci = bodyCell[b] % perSide, cj = bodyCell[b] / perSide;
+            int reach = perSide == 1 ? 0 : 1;
+            for(long oj = -reach; oj <= reach; oj++){
+                for(long oi = -reach; oi <= reach; oi++){
+                    long i = ci + oi, j = cj + oj;
+                    if(periodic){
+                        i = (i + perSide) % perSide;
+                        j = (j + perSide) % perSide;
+                    }
+                    else if(i < 0 || j < 0 || i >= long(perSide) || j >= long(perSide)){
+                        continue;
+                    }
+                    size_t cell = j * perSide + i;
+                    for(unsigned k = cellStart[cell]; k < cellStart[cell + 1]; k++){
+                        unsigned other = cellBodies[k];
+                        if(other != b){
+                            addPair(b, other);
+                        }
+                    }
+                }
+            }
+        }
+    });
+}
+
+void ParticleMesh::computeForces(World& world, ThreadPool& pool){
+    const MeshConfig& mesh = world.config.mesh;
+    const Boundary& boundary = world.config.boundary;
+    if(world.size() == 0){
+        return;
+    }
+    // the radix-2 transform only handles powers of two
+    cells = 1;
+    while(cells < mesh.gridSize){
+        cells *= 2;
+    }
+    if(cells != mesh.gridSize && cells != warnedGridSize){
+        cerr<<"mesh grid size "<<mesh.gridSize<<" is not a power of two, using "<<cells<<endl;
+        warnedGridSize = cells;
+    }
+    periodic = boundary.kind == BoundaryKind::Periodic;
+    points = periodic ? cells : 2 * cells;
+
+    float minX = boundary.minX, minY = boundary.minY, maxX = boundary.maxX, maxY = boundary.maxY;
+    if(boundary.kind == BoundaryKind::Open){    // nothing keeps bodies in the box, so cover them all
+        minX = *min_element(world.x.begin(), world.x.end());
+        maxX = *max_element(world.x.begin(), world.x.end());
+        minY = *min_element(world.y.begin(), world.y.end());
+        maxY = *max_element(world.y.begin(), world.y.end());
+    }
+    float extent = max(maxX - minX, maxY - minY);
+    if(!periodic){
+        extent *= 1.0f + 2.0f / cells;  // keeps the cloud-in-cell footprint of edge bodies on the grid
+        minX -= extent / cells;
+        minY -= extent / cells;
+    }
+    extent = max(extent, 1e-6f);
+    cellSize = extent / cells;
+    originX = minX;
+    originY = minY;
+    splitScale = mesh.splitCells * cellSize;
+
+    StepArenas& arenas = world.arenas();
+    buildKernel(world, pool, arenas);
+    if(world.config.deterministic){
+        depositOrdered(world, pool, arenas.local(0));
+    }
+    else{
+        deposit(world, pool);
+    }
+    transform(grid, false, pool, arenas);
+    pool.run(grid.size(), [&](size_t begin, size_t end, unsigned){
+        double normalize = 1.0 / (double(points) * points);
+        for(size_t c = begin; c < end; c++){
+            grid[c] *= kernel[c] * normalize;
+        }
+    });
+    transform(grid, true, pool, arenas);
+    interpolate(world, pool);
+    if(mesh.shortRange){
+        shortRangeForces(world, pool);
+    }
+}
+
+}
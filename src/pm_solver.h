@@ -0,0 +1,72 @@
+#pragma once
+#include <complex>
+#include <cstddef>
+#include <vector>
+#include "neighbor_list.h"
+
+namespace gravity{
+
+class World;
+class ThreadPool;
+class StepArenas;
+class Arena;
+
+struct MeshConfig{
+    size_t gridSize = 128;      // cells per side, rounded up to a power of two
+    bool shortRange = false;    // P3M: add the exact pairwise force for close pairs
+    float splitCells = 1.25f;   // scale of the long/short range force split, in cells
+    float cutoffSplits = 4.5f;  // short range cutoff, in units of the split scale
+    bool neighborList = false;  // keep the short range pairs in a NeighborList with Config::neighborSkin instead of binning every step
+};
+
+// Particle-mesh gravity. Masses are spread onto a grid with cloud-in-cell weights, the
+// grid is convolved with the gravitational potential through an FFT, and the gradient
+// of the potential is interpolated back to the bodies.
+//
+// The mesh only carries the smooth part of the 1/r^2 force, erf(r / 2rs) / r^2, so the
+// force is softened below about two cells. With shortRange set the missing erfc part is
+// added for pairs closer than the cutoff, which makes close encounters exact again.
+//
+// Config::deterministic switches the deposit to one that adds every grid point's
+// masses in body order, whatever the number of threads. Everything else is already
+// computed the same way on any number of threads.
+//
+// A periodic boundary maps the grid onto the box and uses the nearest image of each
+// cell. Any other boundary uses a grid twice the size with zero padding, so bodies
+// do not feel copies of the box.
+class ParticleMesh{
+public:
+    void computeForces(World& world, ThreadPool& pool);
+
+private:
+    void buildKernel(const World& world, ThreadPool& pool, StepArenas& arenas);
+    void deposit(const World& world, ThreadPool& pool);
+    void depositOrdered(const World& world, ThreadPool& pool, Arena& arena);
+    void interpolate(World& world, ThreadPool& pool);
+    void shortRangeForces(World& world, ThreadPool& pool);
+    void transform(std::vector<std::complex<double>>& data, bool inverse, ThreadPool& pool, StepArenas& arenas);
+
+    size_t cells = 0;       // grid cells per side covering the box
+    size_t warnedGridSize = 0;  // last rounded up gridSize reported, so it is reported once
+    size_t points = 0;      // transform size per side, cells or 2 * cells
+    bool periodic = false;
+    float originX = 0.0f, originY = 0.0f;
+    float cellSize = 0.0f;
+    float splitScale = 0.0f;
+
+    // What the cached kernel was built for
+    size_t kernelPoints = 0;
+    bool kernelPeriodic = false;
+    float kernelCellSize = 0.0f, kernelSplitScale = 0.0f, kernelG = 0.0f;
+
+    double selfPotential[3] = {};               // kernel at offsets of 0, 1 and sqrt(2) cells
+    std::vector<std::complex<double>> kernel;   // transformed potential of a unit mass
+    std::vector<std::complex<double>> grid;     // mass, then potential
+    std::vector<std::vector<double>> threadMass; // per-thread deposit, summed afterwards
+    std::vector<float> forceX, forceY;          // mesh acceleration at grid points
+
+    std::vector<unsigned> cellStart, cellBodies; // short range cell list
+    NeighborList shortRangePairs;               // used instead with MeshConfig::neighborList
+};
+
+}
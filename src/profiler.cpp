@@ -0,0 +1,123 @@
+#include "profiler.h"
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+using namespace std;
+
+namespace gravity{
+
+static const double ROLLING_WEIGHT = 0.05;  // weight of the newest frame, roughly a 20 frame average
+
+const char* PhaseName(Phase phase){
+    switch(phase){
+    case Phase::Force: return "force";
+    case Phase::Integrate: return "integrate";
+    case Phase::BroadPhase: return "broad phase";
+    case Phase::NarrowPhase: return "narrow phase";
+    case Phase::Boundary: return "boundary";
+    case Phase::Render: return "render";
+    case Phase::IO: return "io";
+    case Phase::Count: break;
+    }
+    return "?";
+}
+
+Profiler::Profiler() : origin(chrono::steady_clock::now()){}
+
+Profiler& Profiler::instance(){
+    static Profiler profiler;
+    return profiler;
+}
+
+void Profiler::enable(bool tracing){
+    traceOn.store(tracing);
+    on.store(true);
+}
+
+Profiler::ThreadCounters& Profiler::local(){
+    thread_local ThreadCounters* counters = nullptr;
+    if(!counters){
+        auto created = make_shared<ThreadCounters>();  // the registry keeps it alive after the thread exits
+        lock_guard<mutex> lock(registry);
+        created->thread = unsigned(threads.size());
+        threads.push_back(created);
+        counters = created.get();
+    }
+    return *counters;
+}
+
+void Profiler::endFrame(){
+    int64_t totals[int(Phase::Count)] = {};
+    {
+        lock_guard<mutex> lock(registry);
+        for(const shared_ptr<ThreadCounters>& counters : threads){
+            for(int p = 0; p < int(Phase::Count); p++){
+                totals[p] += counters->nanoseconds[p].load(memory_order_relaxed);
+            }
+        }
+    }
+    int64_t frameEnd = now();
+    PhaseSummary frame;
+    for(int p = 0; p < int(Phase::Count); p++){
+        frame.milliseconds[p] = (totals[p] - lastTotals[p]) / 1e6;
+        lastTotals[p] = totals[p];
+    }
+    frame.frameMilliseconds = (frameEnd - lastFrameEnd) / 1e6;
+    lastFrameEnd = frameEnd;
+
+    lock_guard<mutex> lock(registry);
+    if(!haveFrame){
+        rolling = frame;
+        haveFrame = true;
+        return;
+    }
+    for(int p = 0; p < int(Phase::Count); p++){
+        rolling.milliseconds[p] += ROLLING_WEIGHT * (frame.milliseconds[p] - rolling.milliseconds[p]);
+    }
+    rolling.frameMilliseconds += ROLLING_WEIGHT * (frame.frameMilliseconds - rolling.frameMilliseconds);
+}
+
+PhaseSummary Profiler::summary() const{
+    lock_guard<mutex> lock(registry);
+    return rolling;
+}
+
+string Profiler::summaryText() const{
+    PhaseSummary current = summary();
+    ostringstream text;
+    char buffer[64];
+    snprintf(buffer, sizeof(buffer), "frame %.3f ms", current.frameMilliseconds);
+    text<<buffer;
+    for(int p = 0; p < int(Phase::Count); p++){
+        if(current.milliseconds[p] <= 0.0){
+            continue;
+        }
+        snprintf(buffer, sizeof(buffer), " | %s %.3f", PhaseName(Phase(p)), current.milliseconds[p]);
+        text<<buffer;
+    }
+    return text.str();
+}
+
+bool Profiler::writeChromeTrace(const string& path) const{
+    ofstream out(path);
+    if(!out){
+        return false;
+    }
+    out<<"{\"traceEvents\":[\n";
+    bool firstEvent = true;
+    lock_guard<mutex> lock(registry);
+    for(const shared_ptr<ThreadCounters>& counters : threads){
+        for(const Event& event : counters->events){
+            char line[192];
+            snprintf(line, sizeof(line), "%s{\"name\":\"%s\",\"cat\":\"gravity\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%u}",
+                firstEvent ? "" : ",\n", PhaseName(Phase(event.phase)), event.start / 1e3, event.duration / 1e3, counters->thread);
+            out<<line;
+            firstEvent = false;
+        }
+    }
+    out<<"\n],\"displayTimeUnit\":\"ms\"}\n";
+    return bool(out);
+}
+
+}
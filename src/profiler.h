@@ -0,0 +1,112 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace gravity{
+
+enum class Phase{
+    Force,
+    Integrate,
+    BroadPhase,
+    NarrowPhase,
+    Boundary,
+    Render,
+    IO,
+    Count,
+};
+
+const char* PhaseName(Phase phase);
+
+// Time spent in each phase, per frame, averaged over the last few frames.
+struct PhaseSummary{
+    double milliseconds[int(Phase::Count)] = {};
+    double frameMilliseconds = 0.0;
+};
+
+// Collects the time of every ScopedTimer. Each thread adds to its own counters, so
+// timing a phase costs two clock reads and no locking. Off until enable() is called.
+class Profiler{
+public:
+    static Profiler& instance();
+
+    void enable(bool tracing = false);  // tracing also keeps every interval for writeChromeTrace
+    bool enabled() const{ return on.load(std::memory_order_relaxed); }
+    bool tracing() const{ return traceOn.load(std::memory_order_relaxed); }
+
+    // Closes the current frame and folds it into the rolling average.
+    void endFrame();
+    PhaseSummary summary() const;
+    std::string summaryText() const;
+
+    // Chrome trace event JSON, readable by chrome://tracing and Perfetto. Call it while
+    // no thread is inside a timed phase.
+    bool writeChromeTrace(const std::string& path) const;
+
+    struct Event{
+        uint8_t phase;
+        int64_t start, duration;    // nanoseconds since the profiler was created
+    };
+    struct ThreadCounters{
+        std::atomic<int64_t> nanoseconds[int(Phase::Count)] = {};
+        std::vector<Event> events;
+        unsigned thread = 0;
+    };
+
+    ThreadCounters& local();
+    int64_t now() const{
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - origin).count();
+    }
+
+private:
+    Profiler();
+
+    std::atomic<bool> on{false}, traceOn{false};
+    std::chrono::steady_clock::time_point origin;
+    mutable std::mutex registry;
+    std::vector<std::shared_ptr<ThreadCounters>> threads;
+
+    int64_t lastTotals[int(Phase::Count)] = {};
+    int64_t lastFrameEnd = 0;
+    PhaseSummary rolling;
+    bool haveFrame = false;
+};
+
+// Adds the time until the end of the enclosing scope to a phase.
+class ScopedTimer{
+public:
+    explicit ScopedTimer(Phase phase) : phase(phase){
+        Profiler& profiler = Profiler::instance();
+        if(profiler.enabled()){
+            counters = &profiler.local();
+            start = profiler.now();
+        }
+    }
+    ~ScopedTimer(){
+        if(!counters){
+            return;
+        }
+        Profiler& profiler = Profiler::instance();
+        int64_t duration = profiler.now() - start;
+        std::atomic<int64_t>& total = counters->nanoseconds[int(phase)];
+        total.store(total.load(std::memory_order_relaxed) + duration, std::memory_order_relaxed);   // only this thread writes it
+        if(profiler.tracing() && counters->events.size() < MAX_TRACE_EVENTS){
+            counters->events.push_back({uint8_t(phase), start, duration});
+        }
+    }
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+    static const size_t MAX_TRACE_EVENTS = 1000000; // per thread, so a long trace cannot eat all memory
+
+private:
+    Phase phase;
+    Profiler::ThreadCounters* counters = nullptr;
+    int64_t start = 0;
+};
+
+}
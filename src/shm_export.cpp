@@ -0,0 +1,239 @@
+#include "shm_export.h"
+#include "gravity.h"
+#include <cstring>
+#include <iostream>
+#include <new>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+namespace gravity{
+
+static const uint32_t SHARED_VERSION = 1;
+
+static size_t Align(size_t bytes){
+    return (bytes + 63) & ~size_t(63);  // keeps every slot on its own cache lines
+}
+
+static size_t SlotBytes(uint32_t capacity){
+    return Align(sizeof(SharedSlotHeader)) + Align(capacity * sizeof(float)) * 6 + Align(capacity * sizeof(uint32_t));
+}
+
+// Pointers to the arrays of one slot, in the order they are laid out.
+template<class Byte> static void SlotArrays(Byte* slot, uint32_t capacity, Byte* arrays[7]){
+    Byte* p = slot + Align(sizeof(SharedSlotHeader));
+    for(int a = 0; a < 7; a++){
+        arrays[a] = p;
+        p += Align(capacity * (a < 6 ? sizeof(float) : sizeof(uint32_t)));
+    }
+}
+
+#ifdef _WIN32
+static void* MapShared(const string& name, size_t bytes, bool create, void*& handle){
+    HANDLE mapping = create
+        ? CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, DWORD(uint64_t(bytes) >> 32), DWORD(bytes), name.c_str())
+        : OpenFileMappingA(FILE_MAP_READ, FALSE, name.c_str());
+    if(!mapping){
+        return nullptr;
+    }
+    void* view = MapViewOfFile(mapping, create ? FILE_MAP_ALL_ACCESS : FILE_MAP_READ, 0, 0, bytes);
+    if(!view){
+        CloseHandle(mapping);
+        return nullptr;
+    }
+    handle = mapping;
+    return view;
+}
+
+static void UnmapShared(void* base, size_t, void* handle){
+    UnmapViewOfFile(base);
+    CloseHandle(HANDLE(handle));
+}
+#else
+static void* MapShared(const string& name, size_t bytes, bool create, void*&){
+    string path = "/" + name;
+    int fd = create ? shm_open(path.c_str(), O_CREAT | O_RDWR, 0644) : shm_open(path.c_str(), O_RDONLY, 0);
+    if(fd < 0){
+        return nullptr;
+    }
+    if(create && ftruncate(fd, off_t(bytes)) != 0){
+        close(fd);
+        return nullptr;
+    }
+    if(!create){
+        struct stat info;
+        if(fstat(fd, &info) != 0 || size_t(info.st_size) < bytes){
+            close(fd);
+            return nullptr;
+        }
+    }
+    void* base = mmap(nullptr, bytes, create ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    return base == MAP_FAILED ? nullptr : base;
+}
+
+static void UnmapShared(void* base, size_t bytes, void*){
+    munmap(base, bytes);
+}
+#endif
+
+SharedPublisher::SharedPublisher(const string& name, uint32_t capacity, uint32_t slots) : name(name){
+    slots = max(2u, slots);
+    bytes = Align(sizeof(SharedHeader)) + slots * SlotBytes(capacity);
+    base = static_cast<unsigned char*>(MapShared(name, bytes, true, handle));
+    if(!base){
+        cerr<<"failed to create shared memory "<<name<<endl;
+        return;
+    }
+    SharedHeader* header = new(base) SharedHeader();
+    header->version = SHARED_VERSION;
+    header->slotCount = slots;
+    header->capacity = capacity;
+    header->slotBytes = SlotBytes(capacity);
+    header->published.store(0, memory_order_relaxed);
+    for(uint32_t s = 0; s < slots; s++){
+        SharedSlotHeader* slot = new(base + Align(sizeof(SharedHeader)) + s * header->slotBytes) SharedSlotHeader();
+        slot->sequence.store(0, memory_order_relaxed);
+    }
+    atomic_thread_fence(memory_order_release);
+    memcpy(header->magic, "GSHM", 4);   // last, so a reader never sees a half set up block
+}
+
+SharedPublisher::~SharedPublisher(){
+    if(!base){
+        return;
+    }
+    UnmapShared(base, bytes, handle);
+#ifndef _WIN32
+    shm_unlink(("/" + name).c_str());
+#endif
+}
+
+void SharedPublisher::publish(const World& world){
+    if(!base){
+        return;
+    }
+    SharedHeader* header = reinterpret_cast<SharedHeader*>(base);
+    uint64_t frame = header->published.load(memory_order_relaxed);
+    unsigned char* slotBase = base + Align(sizeof(SharedHeader)) + (frame % header->slotCount) * header->slotBytes;
+    SharedSlotHeader* slot = reinterpret_cast<SharedSlotHeader*>(slotBase);
+
+    uint64_t sequence = slot->sequence.load(memory_order_relaxed);
+    slot->sequence.store(sequence + 1, memory_order_relaxed);   // odd: being written
+    atomic_thread_fence(memory_order_release);
+
+    uint32_t count = uint32_t(min<size_t>(world.size(), header->capacity));
+    slot->frame = frame;
+    slot->step = world.stepCount;
+    slot->time = world.time;
+    slot->count = count;
+    slot->truncated = world.size() > header->capacity;
+    unsigned char* arrays[7];
+    SlotArrays(slotBase, header->capacity, arrays);
+    const vector<float>* sources[6] = {&world.x, &world.y, &world.radius, &world.red, &world.green, &world.blue};
+    for(int a = 0; a < 6; a++){
+        memcpy(arrays[a], sources[a]->data(), count * sizeof(float));
+    }
+    memcpy(arrays[6], world.id.data(), count * sizeof(uint32_t));
+
+    slot->sequence.store(sequence + 2, memory_order_release);   // even: complete
+    header->published.store(frame + 1, memory_order_release);
+}
+
+SharedSubscriber::SharedSubscriber(const string& name){
+    void* headerOnly = MapShared(name, sizeof(SharedHeader), false, handle);
+    if(!headerOnly){
+        return;
+    }
+    const SharedHeader* header = static_cast<const SharedHeader*>(headerOnly);
+    bool valid = memcmp(header->magic, "GSHM", 4) == 0 && header->version == SHARED_VERSION;
+    size_t total = Align(sizeof(SharedHeader)) + header->slotCount * header->slotBytes;
+    UnmapShared(headerOnly, sizeof(SharedHeader), handle);
+    handle = nullptr;
+    if(!valid){
+        return;
+    }
+    base = static_cast<const unsigned char*>(MapShared(name, total, false, handle));
+    bytes = total;
+}
+
+SharedSubscriber::~SharedSubscriber(){
+    if(base){
+        UnmapShared(const_cast<unsigned char*>(base), bytes, handle);
+    }
+}
+
+uint64_t SharedSubscriber::published() const{
+    return base ? reinterpret_cast<const SharedHeader*>(base)->published.load(memory_order_acquire) : 0;
+}
+
+bool SharedSubscriber::latest(SharedFrameView& view) const{
+    uint64_t count = published();
+    if(count == 0){
+        return false;
+    }
+    const SharedHeader* header = reinterpret_cast<const SharedHeader*>(base);
+    uint64_t frame = count - 1;
+    const unsigned char* slotBase = base + Align(sizeof(SharedHeader)) + (frame % header->slotCount) * header->slotBytes;
+    const SharedSlotHeader* slot = reinterpret_cast<const SharedSlotHeader*>(slotBase);
+    uint64_t sequence = slot->sequence.load(memory_order_acquire);
+    if(sequence & 1){
+        return false;
+    }
+    const unsigned char* arrays[7];
+    SlotArrays(slotBase, header->capacity, arrays);
+    view.frame = slot->frame;
+    view.step = slot->step;
+    view.time = slot->time;
+    view.count = min(slot->count, header->capacity);
+    view.x = reinterpret_cast<const float*>(arrays[0]);
+    view.y = reinterpret_cast<const float*>(arrays[1]);
+    view.radius = reinterpret_cast<const float*>(arrays[2]);
+    view.red = reinterpret_cast<const float*>(arrays[3]);
+    view.green = reinterpret_cast<const float*>(arrays[4]);
+    view.blue = reinterpret_cast<const float*>(arrays[5]);
+    view.id = reinterpret_cast<const uint32_t*>(arrays[6]);
+    view.slot = slot;
+    view.sequence = sequence;
+    return validate(view);
+}
+
+bool SharedSubscriber::copyLatest(Snapshot& snapshot) const{
+    const int ATTEMPTS = 4;
+    for(int attempt = 0; attempt < ATTEMPTS && published() > 0; attempt++){
+        SharedFrameView view;
+        if(!latest(view)){
+            continue;   // caught the writer in that slot
+        }
+        const float* sources[6] = {view.x, view.y, view.radius, view.red, view.green, view.blue};
+        vector<float>* targets[6] = {&snapshot.x, &snapshot.y, &snapshot.radius, &snapshot.red, &snapshot.green, &snapshot.blue};
+        for(int a = 0; a < 6; a++){
+            targets[a]->assign(sources[a], sources[a] + view.count);
+        }
+        snapshot.mass.clear();
+        snapshot.step = view.step;
+        snapshot.time = view.time;
+        if(validate(view)){
+            return true;
+        }
+    }
+    return false;
+}
+
+bool SharedSubscriber::validate(const SharedFrameView& view) const{
+    if(!view.slot){
+        return false;
+    }
+    atomic_thread_fence(memory_order_acquire);
+    return view.slot->sequence.load(memory_order_relaxed) == view.sequence;
+}
+
+}
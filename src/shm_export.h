@@ -0,0 +1,98 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "snapshot.h"
+
+namespace gravity{
+
+class World;
+
+// Layout of the shared memory block: a header followed by slotCount slots. Each slot is
+// guarded by a seqlock: its sequence is odd while the writer fills it and even once the
+// frame is complete, so readers never block the writer.
+struct SharedHeader{
+    char magic[4];                      // "GSHM"
+    uint32_t version;
+    uint32_t slotCount;
+    uint32_t capacity;                  // bodies a slot can hold
+    uint64_t slotBytes;
+    std::atomic<uint64_t> published;    // frames published so far, the newest is published - 1
+};
+
+struct SharedSlotHeader{
+    std::atomic<uint64_t> sequence;
+    uint64_t frame;
+    uint64_t step;
+    double time;
+    uint32_t count;                     // bodies in this frame, at most capacity
+    uint32_t truncated;                 // 1 when the world had more bodies than fit
+};
+
+// Read-only pointers straight into a slot. Only trust what was read if validate()
+// still returns true afterwards.
+struct SharedFrameView{
+    uint64_t frame = 0, step = 0;
+    double time = 0.0;
+    uint32_t count = 0;
+    const float *x = nullptr, *y = nullptr, *radius = nullptr;
+    const float *red = nullptr, *green = nullptr, *blue = nullptr;
+    const uint32_t* id = nullptr;
+
+    const SharedSlotHeader* slot = nullptr;
+    uint64_t sequence = 0;
+};
+
+// Writer side: owns the named block and publishes the world into the next slot. The
+// writer laps a reader after `slots` frames, so a slower reader wants more of them.
+class SharedPublisher{
+public:
+    static const uint32_t DEFAULT_SLOTS = 4;
+
+    SharedPublisher(const std::string& name, uint32_t capacity, uint32_t slots = DEFAULT_SLOTS);
+    ~SharedPublisher();
+    SharedPublisher(const SharedPublisher&) = delete;
+    SharedPublisher& operator=(const SharedPublisher&) = delete;
+
+    bool ok() const{ return base != nullptr; }
+    void publish(const World& world);
+
+private:
+    std::string name;
+    unsigned char* base = nullptr;
+    size_t bytes = 0;
+    void* handle = nullptr;
+};
+
+// Reader side: attaches to a block created by a SharedPublisher, in any process.
+class SharedSubscriber{
+public:
+    explicit SharedSubscriber(const std::string& name);
+    ~SharedSubscriber();
+    SharedSubscriber(const SharedSubscriber&) = delete;
+    SharedSubscriber& operator=(const SharedSubscriber&) = delete;
+
+    bool ok() const{ return base != nullptr; }
+    uint64_t published() const;
+
+    // Points view at the newest complete frame without copying. Returns false when
+    // nothing has been published yet or the writer is lapping the reader.
+    bool latest(SharedFrameView& view) const;
+    // True if the slot was not overwritten since latest() handed out the view.
+    bool validate(const SharedFrameView& view) const;
+    // Copies the newest complete frame into snapshot, reusing its memory. The copy takes
+    // far less time than the writer needs to come round the ring again, so unlike
+    // drawing straight from a view it rarely loses the race; a torn copy is retried
+    // with the then newest frame. Returns false when no complete frame could be copied,
+    // in which case snapshot holds nothing worth drawing.
+    bool copyLatest(Snapshot& snapshot) const;
+
+private:
+    const unsigned char* base = nullptr;
+    size_t bytes = 0;
+    void* handle = nullptr;
+};
+
+}
@@ -0,0 +1,126 @@
+#include "gravity.h"
+#include <cmath>
+#include <numeric>
+
+using namespace std;
+
+namespace gravity{
+
+static unsigned FindIsland(ArenaVector<unsigned>& parent, unsigned i){
+    while(parent[i] != i){
+        parent[i] = parent[parent[i]];
+        i = parent[i];
+    }
+    return i;
+}
+
+static bool TouchesWall(const World& world, size_t i){
+    const Boundary& boundary = world.config.boundary;
+    if(boundary.kind != BoundaryKind::Reflective){
+        return false;
+    }
+    float reach = world.radius[i] * 1.01f;
+    return world.x[i] - reach <= boundary.minX || world.x[i] + reach >= boundary.maxX
+        || world.y[i] - reach <= boundary.minY || world.y[i] + reach >= boundary.maxY;
+}
+
+void UpdateSleeping(World& world, const vector<pair<unsigned, unsigned>>& candidates){
+    size_t n = world.size();
+    const SleepConfig& sleep = world.config.sleep;
+    float slowSquared = sleep.speed * sleep.speed;
+
+    for(size_t i = 0; i < n; i++){
+        if(world.asleep[i]){    // a bump from a slow neighbour does not move a sleeping body
+            world.vx[i] = world.vy[i] = 0.0f;
+            continue;
+        }
+        bool slow = world.vx[i] * world.vx[i] + world.vy[i] * world.vy[i] < slowSquared;
+        world.stillSteps[i] = slow ? world.stillSteps[i] + 1 : 0;
+    }
+
+    // bodies that touch this step, a little slack so resting neighbours stay connected
+    vector<pair<unsigned, unsigned>>& touching = world.workspace.touching;
+    touching.clear();
+    for(const pair<unsigned, unsigned>& candidate : candidates){
+        unsigned a = candidate.first, b = candidate.second;
+        float dx = world.x[b] - world.x[a];
+        float dy = world.y[b] - world.y[a];
+        world.config.boundary.minimumImage(dx, dy);
+        float reach = (world.radius[a] + world.radius[b]) * 1.01f;
+        if(dx * dx + dy * dy <= reach * reach){
+            touching.push_back(candidate);
+        }
+    }
+
+    // a moving body touching a sleeping one wakes that body's whole island
+    vector<uint8_t>& wake = world.workspace.wakeIsland;
+    wake.assign(world.nextId, 0);
+    bool anyWake = false;
+    for(const pair<unsigned, unsigned>& t : touching){
+        if(world.asleep[t.first] == world.asleep[t.second]){
+            continue;
+        }
+        unsigned sleeper = world.asleep[t.first] ? t.first : t.second;
+        unsigned mover = world.asleep[t.first] ? t.second : t.first;
+        if(world.stillSteps[mover] == 0){
+            wake[world.island[sleeper]] = 1;
+            anyWake = true;
+        }
+    }
+    if(anyWake){
+        for(size_t i = 0; i < n; i++){
+            if(world.asleep[i] && wake[world.island[i]]){
+                world.asleep[i] = 0;
+                world.stillSteps[i] = 0;
+            }
+        }
+    }
+
+    // islands of awake bodies, joined through contacts
+    Arena& arena = world.arenas().local(0);
+    ArenaVector<unsigned> parent = MakeArenaVector<unsigned>(arena, n);
+    iota(parent.begin(), parent.end(), 0u);
+    ArenaVector<uint8_t> still = MakeArenaVector<uint8_t>(arena, n);
+    ArenaVector<uint8_t> grounded = MakeArenaVector<uint8_t>(arena, n);
+    for(size_t i = 0; i < n; i++){
+        still[i] = world.stillSteps[i] >= sleep.steps;
+        grounded[i] = TouchesWall(world, i);
+    }
+    for(const pair<unsigned, unsigned>& t : touching){
+        bool sleepingA = world.asleep[t.first], sleepingB = world.asleep[t.second];
+        if(sleepingA || sleepingB){
+            if(sleepingA != sleepingB){     // resting on a sleeping pile counts as support
+                grounded[sleepingA ? t.second : t.first] = 1;
+            }
+            continue;
+        }
+        unsigned a = FindIsland(parent, t.first), b = FindIsland(parent, t.second);
+        if(a != b){
+            parent[max(a, b)] = min(a, b);
+            still[min(a, b)] = still[a] && still[b];
+            grounded[min(a, b)] = grounded[a] || grounded[b];
+        }
+    }
+    for(size_t i = 0; i < n; i++){  // fold every body's flags into its root
+        unsigned root = FindIsland(parent, i);
+        still[root] = still[root] && still[i];
+        grounded[root] = grounded[root] || grounded[i];
+    }
+
+    // an island only sleeps when every body in it is slow and something holds it up,
+    // so slow bodies out in open space keep feeling gravity
+    for(size_t i = 0; i < n; i++){
+        if(world.asleep[i]){
+            continue;
+        }
+        unsigned root = FindIsland(parent, i);
+        if(still[root] && grounded[root]){
+            world.asleep[i] = 1;
+            world.island[i] = world.id[root];   // ids survive compaction, indices do not
+            world.vx[i] = world.vy[i] = 0.0f;
+            world.ax[i] = world.ay[i] = 0.0f;
+        }
+    }
+}
+
+}
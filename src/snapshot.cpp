@@ -0,0 +1,43 @@
+#include "snapshot.h"
+#include "gravity.h"
+
+using namespace std;
+
+namespace gravity{
+
+DrawView ViewOf(const World& world){
+    return {world.size(), world.x.data(), world.y.data(), world.radius.data(), world.red.data(), world.green.data(), world.blue.data(),
+        world.mass.data()};
+}
+
+DrawView ViewOf(const Snapshot& snapshot){
+    return {snapshot.size(), snapshot.x.data(), snapshot.y.data(), snapshot.radius.data(),
+        snapshot.red.data(), snapshot.green.data(), snapshot.blue.data(),
+        snapshot.mass.empty() ? nullptr : snapshot.mass.data()};     // shared frames carry no masses
+}
+
+void Capture(const World& world, Snapshot& snapshot){
+    snapshot.x.assign(world.x.begin(), world.x.end());
+    snapshot.y.assign(world.y.begin(), world.y.end());
+    snapshot.radius.assign(world.radius.begin(), world.radius.end());
+    snapshot.red.assign(world.red.begin(), world.red.end());
+    snapshot.green.assign(world.green.begin(), world.green.end());
+    snapshot.blue.assign(world.blue.begin(), world.blue.end());
+    snapshot.mass.assign(world.mass.begin(), world.mass.end());
+    snapshot.step = world.stepCount;
+    snapshot.time = world.time;
+}
+
+void TripleBuffer::publish(){
+    back = middle.exchange(back | FRESH, memory_order_acq_rel) & ~FRESH;
+}
+
+bool TripleBuffer::update(){
+    if(!(middle.load(memory_order_relaxed) & FRESH)){
+        return false;
+    }
+    front = middle.exchange(front, memory_order_acq_rel) & ~FRESH;
+    return true;
+}
+
+}
@@ -0,0 +1,58 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace gravity{
+
+class World;
+
+// What a viewer needs to draw one frame, copied out of the world so the simulation can
+// keep stepping while it is drawn.
+struct Snapshot{
+    std::vector<float> x, y, radius;
+    std::vector<float> red, green, blue;
+    std::vector<float> mass;
+    uint64_t step = 0;
+    double time = 0.0;
+
+    size_t size() const{ return x.size(); }
+};
+
+// Read-only pointers to the drawable arrays of a world, a snapshot or a shared frame, so
+// a viewer can draw any of them without copying a single body.
+struct DrawView{
+    size_t count = 0;
+    const float *x = nullptr, *y = nullptr, *radius = nullptr;
+    const float *red = nullptr, *green = nullptr, *blue = nullptr;
+    const float* mass = nullptr;    // null where the source does not keep masses
+};
+
+DrawView ViewOf(const World& world);
+DrawView ViewOf(const Snapshot& snapshot);
+
+// Copies the drawable state of world into snapshot, reusing its memory.
+void Capture(const World& world, Snapshot& snapshot);
+
+// Three snapshots shared by one producer and one consumer without locks. The producer
+// always has a buffer to write and the consumer always has the newest finished one, so
+// neither ever waits for the other; frames the consumer is too slow for are skipped.
+class TripleBuffer{
+public:
+    Snapshot& writeBuffer(){ return buffers[back]; }
+    void publish();                 // hands the write buffer over as the newest frame
+
+    // Switches the read buffer to the newest frame if there is one. Returns true if it changed.
+    bool update();
+    const Snapshot& readBuffer() const{ return buffers[front]; }
+
+private:
+    static const unsigned FRESH = 4;    // set on middle when it holds a frame the reader has not seen
+
+    Snapshot buffers[3];
+    unsigned back = 0, front = 1;
+    std::atomic<unsigned> middle{2};
+};
+
+}
@@ -0,0 +1,86 @@
+#include "spatial_sort.h"
+#include "arena.h"
+#include "gravity.h"
+#include "parallel.h"
+#include <algorithm>
+#include <numeric>
+
+using namespace std;
+
+namespace gravity{
+
+static uint32_t SpreadBits(uint32_t v){     // 16 bits to the even positions of 32
+    v &= 0xFFFF;
+    v = (v | (v << 8)) & 0x00FF00FF;
+    v = (v | (v << 4)) & 0x0F0F0F0F;
+    v = (v | (v << 2)) & 0x33333333;
+    v = (v | (v << 1)) & 0x55555555;
+    return v;
+}
+
+uint32_t MortonCode(uint32_t x, uint32_t y){
+    return SpreadBits(x) | (SpreadBits(y) << 1);
+}
+
+void RadixSort(uint32_t* keys, uint32_t* values, size_t n, ThreadPool& pool, Arena& arena){
+    const size_t RADIX = 256;
+    unsigned threads = pool.size();
+    uint32_t* keysOut = arena.allocateArray<uint32_t>(n);
+    uint32_t* valuesOut = arena.allocateArray<uint32_t>(n);
+    size_t* counts = arena.allocateArray<size_t>(threads * RADIX);
+    for(int shift = 0; shift < 32; shift += 8){     // an even number of passes, so the result ends up back in keys
+        fill(counts, counts + threads * RADIX, 0);
+        pool.run(n, [&](size_t begin, size_t end, unsigned thread){
+            size_t* count = &counts[thread * RADIX];
+            for(size_t i = begin; i < end; i++){
+                count[(keys[i] >> shift) & 0xFF]++;
+            }
+        });
+        // exclusive prefix over (digit, thread), so thread t writes after threads 0..t-1 for each digit
+        size_t offset = 0;
+        for(size_t digit = 0; digit < RADIX; digit++){
+            for(unsigned t = 0; t < threads; t++){
+                size_t count = counts[t * RADIX + digit];
+                counts[t * RADIX + digit] = offset;
+                offset += count;
+            }
+        }
+        pool.run(n, [&](size_t begin, size_t end, unsigned thread){
+            size_t* position = &counts[thread * RADIX];
+            for(size_t i = begin; i < end; i++){
+                size_t target = position[(keys[i] >> shift) & 0xFF]++;
+                keysOut[target] = keys[i];
+                valuesOut[target] = values[i];
+            }
+        });
+        swap(keys, keysOut);
+        swap(values, valuesOut);
+    }
+}
+
+void SortBodies(World& world){
+    size_t n = world.size();
+    if(n < 2){
+        return;
+    }
+    float minX = *min_element(world.x.begin(), world.x.end());
+    float maxX = *max_element(world.x.begin(), world.x.end());
+    float minY = *min_element(world.y.begin(), world.y.end());
+    float maxY = *max_element(world.y.begin(), world.y.end());
+    float scale = 65535.0f / max(max(maxX - minX, maxY - minY), 1e-20f);   // same scale on both axes
+
+    ThreadPool& pool = world.threadPool();
+    Arena& arena = world.arenas().local(0);
+    ArenaVector<uint32_t> keys = MakeArenaVector<uint32_t>(arena, n);
+    ArenaVector<uint32_t> order = MakeArenaVector<uint32_t>(arena, n);
+    iota(order.begin(), order.end(), 0u);
+    pool.run(n, [&](size_t begin, size_t end, unsigned){
+        for(size_t i = begin; i < end; i++){
+            keys[i] = MortonCode(uint32_t((world.x[i] - minX) * scale), uint32_t((world.y[i] - minY) * scale));
+        }
+    });
+    RadixSort(keys.data(), order.data(), n, pool, arena);
+    world.permute(order.data());
+}
+
+}
@@ -0,0 +1,23 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+namespace gravity{
+
+class World;
+class ThreadPool;
+class Arena;
+
+// Interleaves the bits of two 16 bit coordinates, so nearby points get nearby codes.
+uint32_t MortonCode(uint32_t x, uint32_t y);
+
+// Sorts (key, value) pairs by key with a least significant digit radix sort, eight bits
+// per pass. Each thread counts and scatters its own slice. Equal keys keep their order.
+// The scratch arrays come from arena.
+void RadixSort(uint32_t* keys, uint32_t* values, size_t n, ThreadPool& pool, Arena& arena);
+
+// Reorders every body array along a Morton curve over the bodies' bounding box, so bodies
+// close in space are close in memory. Ids stay with their bodies; use World::indexOf.
+void SortBodies(World& world);
+
+}
@@ -0,0 +1,67 @@
+#include "sweep_prune.h"
+#include "gravity.h"
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+
+namespace gravity{
+
+void SweepAndPrune::rebuild(const World& world){
+    size_t n = world.size();
+    endpoints.resize(2 * n);
+    for(size_t i = 0; i < n; i++){
+        endpoints[2 * i] = {world.x[i] - world.radius[i], uint32_t(i)};
+        endpoints[2 * i + 1] = {world.x[i] + world.radius[i], uint32_t(i) | UPPER};
+    }
+    // one full sort; later steps only fix up their own motion with the insertion sort
+    sort(endpoints.begin(), endpoints.end(), before);
+    builtFor = world.layoutVersion;
+}
+
+void SweepAndPrune::findPairs(const World& world, vector<pair<unsigned, unsigned>>& pairs){
+    size_t n = world.size();
+    if(builtFor != world.layoutVersion || endpoints.size() != 2 * n){
+        rebuild(world);     // bodies changed index, the old order means nothing now
+    }
+    else{
+        for(Endpoint& endpoint : endpoints){
+            uint32_t body = endpoint.body & ~UPPER;
+            endpoint.value = (endpoint.body & UPPER) ? world.x[body] + world.radius[body] : world.x[body] - world.radius[body];
+        }
+        for(size_t i = 1; i < endpoints.size(); i++){   // insertion sort, close to linear from last step's order
+            Endpoint moving = endpoints[i];
+            size_t j = i;
+            while(j > 0 && before(moving, endpoints[j - 1])){
+                endpoints[j] = endpoints[j - 1];
+                j--;
+            }
+            endpoints[j] = moving;
+        }
+    }
+
+    pairs.clear();
+    active.clear();
+    activeSlot.resize(n);
+    for(const Endpoint& endpoint : endpoints){
+        unsigned body = endpoint.body & ~UPPER;
+        if(endpoint.body & UPPER){  // interval closes
+            unsigned last = active.back();
+            active[activeSlot[body]] = last;
+            activeSlot[last] = activeSlot[body];
+            active.pop_back();
+            continue;
+        }
+        for(unsigned other : active){
+            float reach = world.radius[body] + world.radius[other];
+            if(fabs(world.y[body] - world.y[other]) <= reach){
+                pairs.push_back({min(body, other), max(body, other)});
+            }
+        }
+        activeSlot[body] = unsigned(active.size());
+        active.push_back(body);
+    }
+    sort(pairs.begin(), pairs.end());   // same order as the brute force broad phase
+}
+
+}
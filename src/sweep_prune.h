@@ -0,0 +1,38 @@
+#pragma once
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace gravity{
+
+class World;
+
+// Sweep-and-prune broad phase along x. The interval endpoints stay sorted from one step
+// to the next and are fixed up with an insertion sort, which is close to linear because
+// bodies barely change order between steps. Unlike a uniform grid it does not care how
+// different the radii are.
+class SweepAndPrune{
+public:
+    // Pairs whose boxes overlap on both axes, each pair once with the lower index first.
+    void findPairs(const World& world, std::vector<std::pair<unsigned, unsigned>>& pairs);
+
+private:
+    struct Endpoint{
+        float value;
+        uint32_t body;  // top bit set for the upper end of the interval
+    };
+    static const uint32_t UPPER = 0x80000000u;
+
+    // Sweep order: by value, lower ends before upper ends on ties so touching intervals overlap.
+    static bool before(const Endpoint& a, const Endpoint& b){
+        return a.value < b.value || (a.value == b.value && !(a.body & UPPER) && (b.body & UPPER));
+    }
+    void rebuild(const World& world);
+
+    std::vector<Endpoint> endpoints;
+    std::vector<unsigned> active;           // bodies whose interval is open during the sweep
+    std::vector<unsigned> activeSlot;       // where each body sits in active
+    uint64_t builtFor = ~uint64_t(0);       // World::layoutVersion the endpoints belong to
+};
+
+}
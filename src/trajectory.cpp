@@ -0,0 +1,305 @@
+#include "trajectory.h"
+#include "gravity.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+namespace gravity{
+
+static const uint32_t TRAJECTORY_VERSION = 1;
+static const size_t PAGE_BYTES = 4096;     // the stride touch() reads with; smaller than any real page is fine
+
+static size_t Align(size_t bytes){
+    return (bytes + 63) & ~size_t(63);
+}
+
+// Bytes of a frame with count bodies, header included.
+static size_t FrameBytes(uint32_t count){
+    return Align(sizeof(TrajectoryFrameHeader)) + Align(count * sizeof(float)) * 6 + Align(count * sizeof(uint32_t));
+}
+
+TrajectoryWriter::TrajectoryWriter(const string& path) : path(path){
+    file = fopen(path.c_str(), "wb");
+    if(!file){
+        cerr<<"failed to create "<<path<<endl;
+        return;
+    }
+    TrajectoryHeader header = {};
+    memcpy(header.magic, "GTRJ", 4);
+    header.version = TRAJECTORY_VERSION;
+    failed = fwrite(&header, sizeof(header), 1, file) != 1;
+    offset = sizeof(header);
+    pad();
+}
+
+TrajectoryWriter::~TrajectoryWriter(){
+    if(file && !close()){
+        cerr<<"failed to write "<<path<<endl;
+    }
+}
+
+void TrajectoryWriter::pad(){
+    static const char zeros[64] = {};
+    size_t padding = Align(offset) - offset;
+    if(padding > 0){
+        failed |= fwrite(zeros, 1, padding, file) != padding;
+        offset += padding;
+    }
+}
+
+void TrajectoryWriter::write(const World& world){
+    if(!file){
+        return;
+    }
+    frameOffsets.push_back(offset);
+    TrajectoryFrameHeader header = {world.stepCount, world.time, uint32_t(world.size()), 0};
+    failed |= fwrite(&header, sizeof(header), 1, file) != 1;
+    offset += sizeof(header);
+    pad();
+    const vector<float>* arrays[6] = {&world.x, &world.y, &world.radius, &world.red, &world.green, &world.blue};
+    for(const vector<float>* array : arrays){
+        failed |= fwrite(array->data(), sizeof(float), array->size(), file) != array->size();
+        offset += array->size() * sizeof(float);
+        pad();
+    }
+    failed |= fwrite(world.id.data(), sizeof(uint32_t), world.id.size(), file) != world.id.size();
+    offset += world.id.size() * sizeof(uint32_t);
+    pad();
+}
+
+bool TrajectoryWriter::close(){
+    if(!file){
+        return false;
+    }
+    TrajectoryHeader header = {};
+    memcpy(header.magic, "GTRJ", 4);
+    header.version = TRAJECTORY_VERSION;
+    header.frameCount = frameOffsets.size();
+    header.indexOffset = offset;
+    failed |= fwrite(frameOffsets.data(), sizeof(uint64_t), frameOffsets.size(), file) != frameOffsets.size();
+    fflush(file);   // the index is on disk before the header points at it
+    failed |= fseek(file, 0, SEEK_SET) != 0 || fwrite(&header, sizeof(header), 1, file) != 1;
+    failed |= fclose(file) != 0;
+    file = nullptr;
+    return !failed;
+}
+
+#ifdef _WIN32
+static const unsigned char* MapFile(const string& path, size_t& bytes, void*& handle){
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if(file == INVALID_HANDLE_VALUE){
+        return nullptr;
+    }
+    LARGE_INTEGER size;
+    if(!GetFileSizeEx(file, &size) || size.QuadPart == 0){
+        CloseHandle(file);
+        return nullptr;
+    }
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(file);  // the mapping keeps the file open
+    if(!mapping){
+        return nullptr;
+    }
+    void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if(!view){
+        CloseHandle(mapping);
+        return nullptr;
+    }
+    bytes = size_t(size.QuadPart);
+    handle = mapping;
+    return static_cast<const unsigned char*>(view);
+}
+
+static void UnmapFile(const unsigned char* base, size_t, void* handle){
+    UnmapViewOfFile(base);
+    CloseHandle(HANDLE(handle));
+}
+#else
+static const unsigned char* MapFile(const string& path, size_t& bytes, void*&){
+    int fd = open(path.c_str(), O_RDONLY);
+    if(fd < 0){
+        return nullptr;
+    }
+    struct stat info;
+    if(fstat(fd, &info) != 0 || info.st_size == 0){
+        close(fd);
+        return nullptr;
+    }
+    bytes = size_t(info.st_size);
+    void* base = mmap(nullptr, bytes, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    return base == MAP_FAILED ? nullptr : static_cast<const unsigned char*>(base);
+}
+
+static void UnmapFile(const unsigned char* base, size_t bytes, void*){
+    munmap(const_cast<unsigned char*>(base), bytes);
+}
+#endif
+
+TrajectoryReader::TrajectoryReader(const string& path){
+    base = MapFile(path, bytes, handle);
+    if(!base){
+        cerr<<"failed to open "<<path<<endl;
+        return;
+    }
+    const TrajectoryHeader* header = reinterpret_cast<const TrajectoryHeader*>(base);
+    if(bytes < sizeof(TrajectoryHeader) || memcmp(header->magic, "GTRJ", 4) != 0 || header->version != TRAJECTORY_VERSION){
+        cerr<<path<<" is not a trajectory recording"<<endl;
+        UnmapFile(base, bytes, handle);
+        base = nullptr;
+        return;
+    }
+    if(!readIndex()){
+        walkFrames();
+    }
+    frameTimes.resize(frameOffsets.size());
+    for(size_t f = 0; f < frameOffsets.size(); f++){
+        frameTimes[f] = reinterpret_cast<const TrajectoryFrameHeader*>(base + frameOffsets[f])->time;
+    }
+    if(frameOffsets.empty()){
+        cerr<<path<<" holds no frames"<<endl;
+    }
+}
+
+TrajectoryReader::~TrajectoryReader(){
+    if(base){
+        UnmapFile(base, bytes, handle);
+    }
+}
+
+size_t TrajectoryReader::frameBytes(uint64_t offset) const{
+    if(offset % 64 != 0 || offset + sizeof(TrajectoryFrameHeader) > bytes){
+        return 0;
+    }
+    size_t frame = FrameBytes(reinterpret_cast<const TrajectoryFrameHeader*>(base + offset)->count);
+    return frame <= bytes - offset ? frame : 0;
+}
+
+bool TrajectoryReader::readIndex(){
+    const TrajectoryHeader* header = reinterpret_cast<const TrajectoryHeader*>(base);
+    if(header->indexOffset == 0 || header->indexOffset > bytes || header->frameCount > (bytes - header->indexOffset) / sizeof(uint64_t)){
+        return false;
+    }
+    const uint64_t* index = reinterpret_cast<const uint64_t*>(base + header->indexOffset);
+    frameOffsets.assign(index, index + header->frameCount);
+    for(uint64_t offset : frameOffsets){
+        if(frameBytes(offset) == 0){
+            frameOffsets.clear();
+            return false;
+        }
+    }
+    return true;
+}
+
+void TrajectoryReader::walkFrames(){
+    uint64_t offset = Align(sizeof(TrajectoryHeader));
+    double previous = -INFINITY;
+    while(size_t frame = frameBytes(offset)){
+        double time = reinterpret_cast<const TrajectoryFrameHeader*>(base + offset)->time;
+        if(!(time >= previous)){
+            break;      // not a frame this recording wrote
+        }
+        frameOffsets.push_back(offset);
+        previous = time;
+        offset += frame;
+    }
+}
+
+TrajectoryFrame TrajectoryReader::frame(size_t index) const{
+    const unsigned char* p = base + frameOffsets[index];
+    const TrajectoryFrameHeader* header = reinterpret_cast<const TrajectoryFrameHeader*>(p);
+    TrajectoryFrame frame;
+    frame.step = header->step;
+    frame.time = header->time;
+    size_t arrayBytes = Align(header->count * sizeof(float));
+    const float* arrays[6];
+    p += Align(sizeof(TrajectoryFrameHeader));
+    for(int a = 0; a < 6; a++){
+        arrays[a] = reinterpret_cast<const float*>(p);
+        p += arrayBytes;
+    }
+    frame.bodies = {header->count, arrays[0], arrays[1], arrays[2], arrays[3], arrays[4], arrays[5]};
+    frame.id = reinterpret_cast<const uint32_t*>(p);
+    return frame;
+}
+
+size_t TrajectoryReader::frameAt(double time) const{
+    size_t after = size_t(upper_bound(frameTimes.begin(), frameTimes.end(), time) - frameTimes.begin());
+    return after > 0 ? after - 1 : 0;
+}
+
+void TrajectoryReader::touch(size_t index) const{
+    static atomic<unsigned char> sink{0};   // keeps the reads from being optimized away
+    const unsigned char* begin = base + frameOffsets[index];
+    const unsigned char* end = begin + frameBytes(frameOffsets[index]);
+    unsigned char sum = 0;
+    for(const unsigned char* p = begin; p < end; p += PAGE_BYTES){
+        sum += *p;
+    }
+    sink.fetch_add(sum, memory_order_relaxed);
+}
+
+FramePrefetcher::FramePrefetcher(const TrajectoryReader& reader, size_t ahead) : reader(reader), ahead(ahead){
+    worker = thread(&FramePrefetcher::run, this);
+}
+
+FramePrefetcher::~FramePrefetcher(){
+    {
+        lock_guard<mutex> lock(requestMutex);
+        stopping = true;
+    }
+    wake.notify_one();
+    worker.join();
+}
+
+void FramePrefetcher::request(size_t frame, size_t stride){
+    {
+        lock_guard<mutex> lock(requestMutex);
+        if(frame == wantedFrame && stride == wantedStride && requests > 0){
+            return;
+        }
+        wantedFrame = frame;
+        wantedStride = max<size_t>(1, stride);
+        requests++;
+    }
+    wake.notify_one();
+}
+
+void FramePrefetcher::run(){
+    uint64_t handled = 0;
+    unique_lock<mutex> lock(requestMutex);
+    while(true){
+        wake.wait(lock, [&]{ return stopping || requests != handled; });
+        if(stopping){
+            return;
+        }
+        handled = requests;
+        size_t frame = wantedFrame, stride = wantedStride;
+        lock.unlock();
+        for(size_t k = 1; k <= ahead && frame + k * stride < reader.frameCount(); k++){
+            reader.touch(frame + k * stride);
+            if(k % 4 == 0){     // playback moved on, start again from where it is now
+                lock_guard<mutex> check(requestMutex);
+                if(requests != handled || stopping){
+                    break;
+                }
+            }
+        }
+        lock.lock();
+    }
+}
+
+}
@@ -0,0 +1,125 @@
+#pragma once
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "snapshot.h"
+
+namespace gravity{
+
+class World;
+
+// A recorded run on disk: a header, one record per frame and an index of where every
+// frame starts. A frame is a TrajectoryFrameHeader followed by the x, y, radius, red,
+// green, blue and id arrays of its bodies, every part on its own 64 byte boundary, so a
+// reader can draw straight out of the mapped file.
+//
+// The index and the frame count are only written when the recording is closed. A file
+// whose writer never got that far (a killed batch job) is still readable: the reader
+// walks the frames from the start instead and drops a torn last one.
+struct TrajectoryHeader{
+    char magic[4];          // "GTRJ"
+    uint32_t version;
+    uint64_t frameCount;    // 0 until closed
+    uint64_t indexOffset;   // 0 until closed
+};
+
+struct TrajectoryFrameHeader{
+    uint64_t step;
+    double time;
+    uint32_t count;         // bodies in this frame
+    uint32_t reserved;
+};
+
+// One frame of a mapped recording. The pointers stay valid as long as the reader.
+struct TrajectoryFrame{
+    uint64_t step = 0;
+    double time = 0.0;
+    DrawView bodies;
+    const uint32_t* id = nullptr;
+};
+
+// Appends frames to a new recording.
+class TrajectoryWriter{
+public:
+    explicit TrajectoryWriter(const std::string& path);
+    ~TrajectoryWriter();
+    TrajectoryWriter(const TrajectoryWriter&) = delete;
+    TrajectoryWriter& operator=(const TrajectoryWriter&) = delete;
+
+    bool ok() const{ return file != nullptr; }
+    void write(const World& world);
+    // Writes the index and the final header. Returns false if anything failed to write.
+    bool close();
+
+private:
+    void pad();
+
+    std::string path;
+    FILE* file = nullptr;
+    bool failed = false;
+    uint64_t offset = 0;
+    std::vector<uint64_t> frameOffsets;
+};
+
+// Maps a recording read-only. Frames are read straight from the mapping, so opening
+// even a huge file costs only its index and the pages that are actually drawn.
+class TrajectoryReader{
+public:
+    explicit TrajectoryReader(const std::string& path);
+    ~TrajectoryReader();
+    TrajectoryReader(const TrajectoryReader&) = delete;
+    TrajectoryReader& operator=(const TrajectoryReader&) = delete;
+
+    bool ok() const{ return base != nullptr && !frameOffsets.empty(); }
+    size_t frameCount() const{ return frameOffsets.size(); }
+    TrajectoryFrame frame(size_t index) const;
+    double time(size_t index) const{ return frameTimes[index]; }
+    // The last frame recorded at or before time, the first one if time is earlier.
+    size_t frameAt(double time) const;
+    // Reads one byte of every page of frame index, so later reads of it do not fault.
+    void touch(size_t index) const;
+
+private:
+    bool readIndex();
+    void walkFrames();
+    size_t frameBytes(uint64_t offset) const;   // 0 if the frame does not fit in the file
+
+    const unsigned char* base = nullptr;
+    size_t bytes = 0;
+    void* handle = nullptr;
+    std::vector<uint64_t> frameOffsets;
+    std::vector<double> frameTimes;
+};
+
+// Touches the frames playback is about to show on a background thread, so the viewer
+// does not stall on page faults when the recording sits on a slow disk.
+class FramePrefetcher{
+public:
+    explicit FramePrefetcher(const TrajectoryReader& reader, size_t ahead = 32);
+    ~FramePrefetcher();
+    FramePrefetcher(const FramePrefetcher&) = delete;
+    FramePrefetcher& operator=(const FramePrefetcher&) = delete;
+
+    // Playback is at frame and moves stride frames per shown frame, so the frames
+    // frame + stride, frame + 2 stride, ... are loaded next.
+    void request(size_t frame, size_t stride);
+
+private:
+    void run();
+
+    const TrajectoryReader& reader;
+    size_t ahead;
+    std::mutex requestMutex;
+    std::condition_variable wake;
+    size_t wantedFrame = 0, wantedStride = 1;
+    uint64_t requests = 0;
+    bool stopping = false;
+    std::thread worker;
+};
+
+}
@@ -0,0 +1,212 @@
+#include "transport.h"
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+
+#ifndef _WIN32
+#include <cerrno>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+namespace gravity{
+
+bool SingleTransport::exchange(const vector<vector<char>>& outgoing, vector<vector<char>>& incoming){
+    incoming.resize(1);
+    incoming[0] = outgoing[0];
+    return true;
+}
+
+#ifdef _WIN32
+unique_ptr<Transport> SocketTransport::Fork(int ranks){
+    if(ranks > 1){
+        cerr<<"multi-process runs need fork, running as a single process"<<endl;
+    }
+    return unique_ptr<Transport>(new SingleTransport());
+}
+
+SocketTransport::~SocketTransport(){}
+
+bool SocketTransport::exchange(const vector<vector<char>>& outgoing, vector<vector<char>>& incoming){
+    incoming.assign(outgoing.begin(), outgoing.end());
+    return true;
+}
+#else
+unique_ptr<Transport> SocketTransport::Fork(int ranks){
+    if(ranks <= 1){
+        return unique_ptr<Transport>(new SingleTransport());
+    }
+    // one socket pair per pair of ranks, all made before forking so every child inherits them
+    vector<int> ends(size_t(ranks) * ranks, -1);    // ends[a * ranks + b]: a's end of the a-b socket
+    for(int a = 0; a < ranks; a++){
+        for(int b = a + 1; b < ranks; b++){
+            int pair[2];
+            if(socketpair(AF_UNIX, SOCK_STREAM, 0, pair) != 0){
+                cerr<<"socketpair failed: "<<strerror(errno)<<endl;
+                for(int fd : ends){
+                    if(fd >= 0){
+                        close(fd);
+                    }
+                }
+                return nullptr;
+            }
+            ends[a * ranks + b] = pair[0];
+            ends[b * ranks + a] = pair[1];
+        }
+    }
+    int rank = 0;
+    for(int r = 1; r < ranks; r++){
+        pid_t pid = fork();
+        if(pid < 0){
+            cerr<<"fork failed: "<<strerror(errno)<<endl;
+            for(int fd : ends){     // the children already running see their sockets close
+                if(fd >= 0){
+                    close(fd);
+                }
+            }
+            while(wait(nullptr) > 0){}
+            return nullptr;
+        }
+        if(pid == 0){
+            rank = r;
+            break;
+        }
+    }
+    vector<int> peers(ranks, -1);
+    for(int a = 0; a < ranks; a++){
+        for(int b = 0; b < ranks; b++){
+            int fd = ends[a * ranks + b];
+            if(fd < 0){
+                continue;
+            }
+            if(a == rank){
+                peers[b] = fd;
+                fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+            }
+            else{
+                close(fd);
+            }
+        }
+    }
+    return unique_ptr<Transport>(new SocketTransport(rank, peers));
+}
+
+SocketTransport::~SocketTransport(){
+    for(int fd : peers){
+        if(fd >= 0){
+            close(fd);
+        }
+    }
+    if(myRank == 0){
+        while(wait(nullptr) > 0){}  // the other ranks are this process's children
+    }
+}
+
+bool SocketTransport::exchange(const vector<vector<char>>& outgoing, vector<vector<char>>& incoming){
+    if(broken){
+        return false;
+    }
+    int ranks = size();
+    incoming.resize(ranks);
+    incoming[myRank] = outgoing[myRank];
+
+    // every message goes out as an 8 byte length and the payload
+    struct Progress{
+        uint64_t sendLength = 0, receiveLength = 0;
+        size_t sent = 0, received = 0;  // bytes so far, the length included
+    };
+    auto receiving = [](const Progress& p){ return p.received < 8 || p.received < 8 + p.receiveLength; };
+    vector<Progress> progress(ranks);
+    size_t open = 0;
+    for(int r = 0; r < ranks; r++){
+        if(r != myRank){
+            progress[r].sendLength = outgoing[r].size();
+            open += 2;
+        }
+    }
+    vector<pollfd> polls;
+    vector<int> pollRank;
+    while(open > 0){
+        polls.clear();
+        pollRank.clear();
+        for(int r = 0; r < ranks; r++){
+            if(r == myRank){
+                continue;
+            }
+            Progress& p = progress[r];
+            short events = 0;
+            if(p.sent < 8 + p.sendLength){
+                events |= POLLOUT;
+            }
+            if(receiving(p)){
+                events |= POLLIN;
+            }
+            if(events){
+                polls.push_back({peers[r], events, 0});
+                pollRank.push_back(r);
+            }
+        }
+        if(poll(polls.data(), polls.size(), -1) < 0){
+            if(errno == EINTR){
+                continue;
+            }
+            cerr<<"poll failed: "<<strerror(errno)<<endl;
+            broken = true;
+            return false;
+        }
+        for(size_t k = 0; k < polls.size(); k++){
+            int r = pollRank[k];
+            Progress& p = progress[r];
+            int fd = polls[k].fd;
+            if(polls[k].revents & POLLOUT){
+                const char* header = reinterpret_cast<const char*>(&p.sendLength);
+                ssize_t written = p.sent < 8
+                    ? send(fd, header + p.sent, 8 - p.sent, MSG_NOSIGNAL)
+                    : send(fd, outgoing[r].data() + (p.sent - 8), 8 + p.sendLength - p.sent, MSG_NOSIGNAL);
+                if(written < 0 && errno != EAGAIN && errno != EINTR){
+                    cerr<<"rank "<<r<<" went away, stopping rank "<<myRank<<endl;
+                    broken = true;
+                    return false;
+                }
+                if(written > 0){
+                    p.sent += size_t(written);
+                    if(p.sent == 8 + p.sendLength){
+                        open--;
+                    }
+                }
+            }
+            if(receiving(p) && (polls[k].revents & (POLLIN | POLLHUP | POLLERR))){
+                ssize_t got;
+                if(p.received < 8){
+                    got = read(fd, reinterpret_cast<char*>(&p.receiveLength) + p.received, 8 - p.received);
+                }
+                else{
+                    got = read(fd, incoming[r].data() + (p.received - 8), 8 + p.receiveLength - p.received);
+                }
+                if(got == 0 || (got < 0 && errno != EAGAIN && errno != EINTR)){
+                    cerr<<"rank "<<r<<" went away, stopping rank "<<myRank<<endl;
+                    broken = true;
+                    return false;
+                }
+                if(got > 0){
+                    p.received += size_t(got);
+                    if(p.received == 8){
+                        incoming[r].resize(p.receiveLength);
+                    }
+                    if(p.received == 8 + p.receiveLength){
+                        open--;
+                    }
+                }
+            }
+        }
+    }
+    return true;
+}
+#endif
+
+}
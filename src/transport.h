@@ -0,0 +1,58 @@
+#pragma once
+#include <cstddef>
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace gravity{
+
+// Message passing between the ranks of one decomposed simulation, see domain.h. A
+// transport only has to provide one collective: every rank hands over one message per
+// rank and gets one back from each. Everything the domain needs is built on that, so a
+// new transport (TCP between nodes, MPI) is one class.
+class Transport{
+public:
+    virtual ~Transport() = default;
+
+    virtual int rank() const = 0;
+    virtual int size() const = 0;
+
+    // outgoing[r] goes to rank r; incoming[r] is what rank r sent here. Every rank has to
+    // call it, in the same order. The message to itself is passed through. Returns false
+    // if another rank went away; incoming is incomplete then and every later call fails too.
+    virtual bool exchange(const std::vector<std::vector<char>>& outgoing, std::vector<std::vector<char>>& incoming) = 0;
+};
+
+// The trivial transport of a simulation that is not decomposed.
+class SingleTransport : public Transport{
+public:
+    int rank() const override{ return 0; }
+    int size() const override{ return 1; }
+    bool exchange(const std::vector<std::vector<char>>& outgoing, std::vector<std::vector<char>>& incoming) override;
+};
+
+// Processes on one machine connected pairwise by Unix domain sockets. Large messages are
+// interleaved with poll() so two ranks sending to each other never block on a full
+// socket buffer.
+class SocketTransport : public Transport{
+public:
+    // Forks ranks - 1 child processes and connects all of them. Every process returns
+    // from here with its own rank; the calling process is rank 0. Where fork is not
+    // available this returns a single rank transport. Returns null if the sockets or a
+    // child could not be made; children forked before that fail their first exchange.
+    static std::unique_ptr<Transport> Fork(int ranks);
+
+    ~SocketTransport() override;
+    int rank() const override{ return myRank; }
+    int size() const override{ return int(peers.size()); }
+    bool exchange(const std::vector<std::vector<char>>& outgoing, std::vector<std::vector<char>>& incoming) override;
+
+private:
+    SocketTransport(int rank, std::vector<int> peers) : myRank(rank), peers(std::move(peers)){}
+
+    int myRank;
+    std::vector<int> peers;     // socket to each rank, -1 for this one
+    bool broken = false;        // a rank went away
+};
+
+}
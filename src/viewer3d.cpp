@@ -0,0 +1,96 @@
+#include "viewer3d.h"
+#include "world3d.h"
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+
+namespace gravity{
+
+static void Normalize(float v[3]){
+    float length = sqrt(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+    if(length > 0.0f){
+        v[0] /= length; v[1] /= length; v[2] /= length;
+    }
+}
+
+static void Cross(const float a[3], const float b[3], float out[3]){
+    out[0] = a[1] * b[2] - a[2] * b[1];
+    out[1] = a[2] * b[0] - a[0] * b[2];
+    out[2] = a[0] * b[1] - a[1] * b[0];
+}
+
+void Camera::orbit(float yaw, float pitch, float distance){
+    // up is taken as z, the axis the default scene orbits around
+    eye[0] = target[0] + distance * cos(pitch) * sin(yaw);
+    eye[1] = target[1] - distance * cos(pitch) * cos(yaw);
+    eye[2] = target[2] + distance * sin(pitch);
+}
+
+ViewPoint Camera::toView(float x, float y, float z) const{
+    float forward[3] = {target[0] - eye[0], target[1] - eye[1], target[2] - eye[2]};
+    Normalize(forward);
+    float right[3], cameraUp[3];
+    Cross(forward, up, right);
+    Normalize(right);
+    Cross(right, forward, cameraUp);
+    float d[3] = {x - eye[0], y - eye[1], z - eye[2]};
+    return {
+        d[0] * right[0] + d[1] * right[1] + d[2] * right[2],
+        d[0] * cameraUp[0] + d[1] * cameraUp[1] + d[2] * cameraUp[2],
+        d[0] * forward[0] + d[1] * forward[1] + d[2] * forward[2],
+    };
+}
+
+float Camera::focalLength() const{
+    return 1.0f / tan(0.5f * fieldOfView * 3.14159265f / 180.0f);
+}
+
+float SphereShade(float nx, float ny, float nz){
+    const float lx = -0.3f, ly = 0.4f, lz = -0.866f;    // toward the light, unit length
+    return 0.25f + 0.75f * max(0.0f, nx * lx + ny * ly + nz * lz);
+}
+
+void RenderSpheres(const World3D& world, const Camera& camera, Image& image){
+    image.clear();
+    float focal = camera.focalLength();
+    float aspect = float(image.width) / image.height;
+    float halfHeight = 0.5f * image.height;
+    for(size_t i = 0; i < world.size(); i++){
+        ViewPoint p = camera.toView(world.x[i], world.y[i], world.z[i]);
+        if(p.depth - world.radius[i] < camera.nearPlane || p.depth > camera.farPlane){
+            continue;
+        }
+        // the impostor: a screen-aligned disc shaded as the visible half of the sphere
+        float centerX = (p.x * focal / (p.depth * aspect) * 0.5f + 0.5f) * image.width;
+        float centerY = (0.5f - p.y * focal / p.depth * 0.5f) * image.height;
+        float pixelRadius = max(world.radius[i] * focal / p.depth * halfHeight, 0.5f);   // far bodies stay one pixel
+        int left = max(0, int(floor(centerX - pixelRadius)));
+        int right = min(image.width - 1, int(ceil(centerX + pixelRadius)));
+        int top = max(0, int(floor(centerY - pixelRadius)));
+        int bottom = min(image.height - 1, int(ceil(centerY + pixelRadius)));
+        for(int row = top; row <= bottom; row++){
+            for(int column = left; column <= right; column++){
+                float u = (column + 0.5f - centerX) / pixelRadius;
+                float v = (centerY - (row + 0.5f)) / pixelRadius;
+                float r2 = u * u + v * v;
+                if(r2 > 1.0f){
+                    continue;
+                }
+                float nz = -sqrt(1.0f - r2);    // facing the camera
+                float depth = p.depth + world.radius[i] * nz;
+                size_t pixel = size_t(row) * image.width + column;
+                if(depth >= image.depth[pixel]){
+                    continue;
+                }
+                image.depth[pixel] = depth;
+                float shade = SphereShade(u, v, nz);
+                image.rgb[pixel * 3 + 0] = uint8_t(min(255.0f, world.red[i] * shade * 255.0f));
+                image.rgb[pixel * 3 + 1] = uint8_t(min(255.0f, world.green[i] * shade * 255.0f));
+                image.rgb[pixel * 3 + 2] = uint8_t(min(255.0f, world.blue[i] * shade * 255.0f));
+            }
+        }
+    }
+}
+
+}
@@ -0,0 +1,37 @@
+#pragma once
+#include "offscreen.h"
+
+// Perspective camera and sphere impostor shading for World3D. Nothing here touches
+// OpenGL: the window draws with these transforms, and RenderSpheres draws the same
+// picture into memory for runs without a window.
+namespace gravity{
+
+class World3D;
+
+// Position of a point relative to the camera: x to the right, y up, depth straight ahead.
+struct ViewPoint{
+    float x, y, depth;
+};
+
+struct Camera{
+    float eye[3] = {0.0f, -2.4f, 1.2f};
+    float target[3] = {0.0f, 0.0f, 0.0f};
+    float up[3] = {0.0f, 0.0f, 1.0f};
+    float fieldOfView = 45.0f;  // vertical, in degrees
+    float nearPlane = 0.01f;
+    float farPlane = 100.0f;
+
+    // Puts the eye `distance` away from target, turned yaw radians around up and raised pitch radians.
+    void orbit(float yaw, float pitch, float distance);
+    ViewPoint toView(float x, float y, float z) const;
+    float focalLength() const;  // 1 / tan(fieldOfView / 2)
+};
+
+// Brightness of a sphere's surface with view space normal (nx, ny, nz), lit from above
+// and to the left of the camera.
+float SphereShade(float nx, float ny, float nz);
+
+// Draws every body as a shaded, depth-tested sphere, the offscreen version of the window.
+void RenderSpheres(const World3D& world, const Camera& camera, Image& image);
+
+}
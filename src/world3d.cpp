@@ -0,0 +1,164 @@
+#include "world3d.h"
+#include "kernels.h"
+#include "octree.h"
+#include "parallel.h"
+#include "profiler.h"
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+
+namespace gravity{
+
+Workspace3D::Workspace3D() = default;
+Workspace3D::Workspace3D(const Workspace3D&){}
+Workspace3D& Workspace3D::operator=(const Workspace3D&){ return *this; }
+Workspace3D::~Workspace3D() = default;
+
+static float Component(const vector<float>& v, size_t k){
+    return k < v.size() ? v[k] : 0.0f;
+}
+
+size_t World3D::addBody(const Object& object){
+    x.push_back(Component(object.center, 0));
+    y.push_back(Component(object.center, 1));
+    z.push_back(Component(object.center, 2));
+    vx.push_back(Component(object.velocity, 0));
+    vy.push_back(Component(object.velocity, 1));
+    vz.push_back(Component(object.velocity, 2));
+    ax.push_back(Component(object.acceleration, 0));
+    ay.push_back(Component(object.acceleration, 1));
+    az.push_back(Component(object.acceleration, 2));
+    mass.push_back(object.massKg);
+    radius.push_back(object.radius);
+    red.push_back(object.color[0]);
+    green.push_back(object.color[1]);
+    blue.push_back(object.color[2]);
+    id.push_back(uint32_t(id.size()));
+    return x.size() - 1;
+}
+
+ThreadPool& World3D::threadPool(){
+    if(!workspace.pool || workspace.pool->size() != max(1u, config.threads)){
+        workspace.pool.reset(new ThreadPool(config.threads));
+    }
+    return *workspace.pool;
+}
+
+void Collides(World3D& world, size_t a, size_t b){
+    Vec<3> d = {world.x[b] - world.x[a], world.y[b] - world.y[a], world.z[b] - world.z[a]};
+    BounceBodies<3>({world.x.data(), world.y.data(), world.z.data()}, {world.vx.data(), world.vy.data(), world.vz.data()},
+        world.mass.data(), world.radius.data(), a, b, d, world.config.restitution);
+}
+
+// Pairs whose bounding cubes overlap, from a sweep over the bodies sorted by their lowest x.
+static void BroadPhase(World3D& world, vector<pair<unsigned, unsigned>>& candidates){
+    size_t n = world.size();
+    vector<uint32_t>& order = world.workspace.order;
+    order.resize(n);
+    for(size_t i = 0; i < n; i++){
+        order[i] = uint32_t(i);
+    }
+    sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b){
+        return world.x[a] - world.radius[a] < world.x[b] - world.radius[b];
+    });
+    candidates.clear();
+    for(size_t k = 0; k < n; k++){
+        uint32_t i = order[k];
+        float right = world.x[i] + world.radius[i];
+        for(size_t m = k + 1; m < n; m++){
+            uint32_t j = order[m];
+            if(world.x[j] - world.radius[j] > right){   // nothing further along can reach i
+                break;
+            }
+            float reach = world.radius[i] + world.radius[j];
+            if(fabs(world.y[j] - world.y[i]) <= reach && fabs(world.z[j] - world.z[i]) <= reach){
+                candidates.push_back({min(i, j), max(i, j)});
+            }
+        }
+    }
+    sort(candidates.begin(), candidates.end());     // same order of bounces as a loop over i < j
+}
+
+void CollisionDetect(World3D& world){
+    vector<pair<unsigned, unsigned>>& candidates = world.workspace.candidates;
+    {
+        ScopedTimer timer(Phase::BroadPhase);
+        BroadPhase(world, candidates);
+    }
+    ScopedTimer timer(Phase::NarrowPhase);
+    for(const pair<unsigned, unsigned>& candidate : candidates){
+        size_t i = candidate.first, j = candidate.second;
+        float dx = world.x[j] - world.x[i];
+        float dy = world.y[j] - world.y[i];
+        float dz = world.z[j] - world.z[i];
+        float distance = sqrt(dx * dx + dy * dy + dz * dz);
+        if(distance <= world.radius[i] + world.radius[j] && distance != 0){
+            Collides(world, i, j);
+        }
+    }
+}
+
+void ComputeForces(World3D& world){
+    ScopedTimer timer(Phase::Force);
+    fill(world.ax.begin(), world.ax.end(), 0.0f);
+    fill(world.ay.begin(), world.ay.end(), 0.0f);
+    fill(world.az.begin(), world.az.end(), 0.0f);
+    ThreadPool& pool = world.threadPool();
+    switch(world.config.force){
+    case ForceBackend3D::Direct:
+        pool.run(world.size(), [&](size_t begin, size_t end, unsigned){
+            for(size_t i = begin; i < end; i++){
+                Vec<3> acceleration = {0.0f, 0.0f, 0.0f};
+                if(world.config.kernel == ForceKernel::FastRsqrt){
+                    DirectAcceleration<3, ForceKernel::FastRsqrt>(i, world.size(), {world.x.data(), world.y.data(), world.z.data()},
+                        world.mass.data(), world.config.gravitationalConstant, NoImage(), acceleration, nullptr);
+                }
+                else{
+                    DirectAcceleration<3>(i, world.size(), {world.x.data(), world.y.data(), world.z.data()}, world.mass.data(),
+                        world.config.gravitationalConstant, NoImage(), acceleration, nullptr);
+                }
+                world.ax[i] += acceleration[0];
+                world.ay[i] += acceleration[1];
+                world.az[i] += acceleration[2];
+            }
+        });
+        break;
+    case ForceBackend3D::BarnesHut:
+        if(!world.workspace.octree){
+            world.workspace.octree.reset(new Octree());
+        }
+        world.workspace.octree->build(world);
+        world.workspace.octree->computeForces(world, pool);
+        break;
+    }
+}
+
+uint64_t StateHash(const World3D& world){
+    uint64_t hash = FNV_OFFSET;
+    auto add = [&](const void* data, size_t bytes){ hash = HashBytes(hash, data, bytes); };
+    add(&world.stepCount, sizeof(world.stepCount));
+    add(&world.time, sizeof(world.time));
+    for(size_t i = 0; i < world.size(); i++){
+        float values[8] = {world.x[i], world.y[i], world.z[i], world.vx[i], world.vy[i], world.vz[i], world.mass[i], world.radius[i]};
+        add(&world.id[i], sizeof(world.id[i]));
+        add(values, sizeof(values));
+    }
+    return hash;
+}
+
+void step(World3D& world, float dt){
+    ComputeForces(world);
+    {
+        ScopedTimer timer(Phase::Integrate);
+        KickDrift<3>({world.x.data(), world.y.data(), world.z.data()}, {world.vx.data(), world.vy.data(), world.vz.data()},
+            {world.ax.data(), world.ay.data(), world.az.data()}, world.size(), dt, [](size_t){ return false; });
+    }
+    if(world.config.collisions){
+        CollisionDetect(world);
+    }
+    world.stepCount++;
+    world.time += dt;
+}
+
+}
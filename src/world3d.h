@@ -0,0 +1,84 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+#include "gravity.h"
+
+// Three dimensional counterpart of World for systems that are not flat. It shares the
+// force formula with the 2D engine through kernels.h and adds a Barnes-Hut octree, so
+// large clouds do not need the O(N^2) direct sum.
+namespace gravity{
+
+enum class ForceBackend3D{
+    Direct,     // pairwise sum over every other body, O(N^2)
+    BarnesHut,  // far groups of bodies replaced by their center of mass, see octree.h
+};
+
+struct Config3D{
+    float gravitationalConstant = 0.00000001f;
+    float restitution = 0.9f;       // bounce between two bodies
+    ForceBackend3D force = ForceBackend3D::Direct;
+    float openingAngle = 0.5f;      // Barnes-Hut: a node closer than size / openingAngle is opened
+    bool collisions = true;         // sphere overlap test and bounce
+    unsigned threads = 1;           // worker threads for the force pass
+    ForceKernel kernel = ForceKernel::Exact;   // how ForceBackend3D::Direct evaluates each pair
+};
+
+class Octree;
+
+// Scratch state kept between steps; like Workspace, copies start empty.
+struct Workspace3D{
+    std::unique_ptr<ThreadPool> pool;
+    std::unique_ptr<Octree> octree;
+    std::vector<uint32_t> order;    // body indices sorted along x for the collision sweep
+    std::vector<std::pair<unsigned, unsigned>> candidates;
+
+    Workspace3D();
+    Workspace3D(const Workspace3D&);
+    Workspace3D& operator=(const Workspace3D&);
+    ~Workspace3D();
+};
+
+class World3D{
+public:
+    Config3D config;
+
+    std::vector<float> x, y, z;     // center
+    std::vector<float> vx, vy, vz;  // velocity
+    std::vector<float> ax, ay, az;  // acceleration from the last force pass
+    std::vector<float> mass;
+    std::vector<float> radius;
+    std::vector<float> red, green, blue;
+    std::vector<uint32_t> id;
+
+    uint64_t stepCount = 0;
+    double time = 0.0;
+
+    Workspace3D workspace;
+
+    World3D() = default;
+    explicit World3D(const Config3D& config) : config(config){}
+
+    size_t size() const{ return x.size(); }
+    // Takes the third component of center, velocity and acceleration when there is one, 0 otherwise.
+    size_t addBody(const Object& object);
+    ThreadPool& threadPool();
+};
+
+// Forces, integration and sphere collisions for every body. There is no boundary: 3D
+// worlds are open.
+void step(World3D& world, float dt);
+
+void ComputeForces(World3D& world);
+void CollisionDetect(World3D& world);
+
+// Bounce response for one touching pair of spheres.
+void Collides(World3D& world, size_t a, size_t b);
+
+// StateHash for 3D worlds: the step count, the time and every body's id, position,
+// velocity, mass and radius. Bodies never change index in a World3D, so index order is id order.
+uint64_t StateHash(const World3D& world);
+
+}